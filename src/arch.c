@@ -27,7 +27,9 @@
 #include "translator.h"
 
 #include "arch/amd64.h"
+#include "arch/elf64.h"
 #include "arch/i386.h"
+#include "arch/peephole.h"
 #include "arch/8086.h"
 #include "arch/z80.h"
 #include "arch/bfir.h"
@@ -46,6 +48,7 @@ extern void BFa_translate() {
 		if(!strcmp(BFa_target_arch, "8086")) extension = ".asm";
 		else if(!strcmp(BFa_target_arch, "z80")) extension = ".asm";
 		else if(!strcmp(BFa_target_arch, "bfir")) extension = ".bfir";
+		else if(!strcmp(BFa_target_arch, "elf64")) extension = "";
 
 		strcpy(BFf_outfile_name, BFf_mainfile_name);
 		size_t len = strlen(BFf_outfile_name);
@@ -68,11 +71,26 @@ extern void BFa_translate() {
 
 	BFo_optimise();
 
-	if(!strcmp(BFa_target_arch, "amd64")) BFa_amd64_tasm(file);
-	else if(!strcmp(BFa_target_arch, "i386")) BFa_i386_tasm(file);
-	else if(!strcmp(BFa_target_arch, "8086")) BFa_8086_t(file);
+	bool peephole = BFo_level != '0';
+
+	if(!strcmp(BFa_target_arch, "amd64")) {
+		if(peephole) BFa_peephole(file, BFa_amd64_tasm, false);
+		else BFa_amd64_tasm(file);
+	}
+
+	else if(!strcmp(BFa_target_arch, "i386")) {
+		if(peephole) BFa_peephole(file, BFa_i386_tasm, false);
+		else BFa_i386_tasm(file);
+	}
+
+	else if(!strcmp(BFa_target_arch, "8086")) {
+		if(peephole) BFa_peephole(file, BFa_8086_t, true);
+		else BFa_8086_t(file);
+	}
+
 	else if(!strcmp(BFa_target_arch, "z80")) BFa_z80_t(file);
 	else if(!strcmp(BFa_target_arch, "bfir")) BFa_bfir_t(file);
+	else if(!strcmp(BFa_target_arch, "elf64")) BFa_elf64_t(file);
 
 	else { BFe_report_err(BFE_BAD_ARCH); exit(BFE_BAD_ARCH); }
 
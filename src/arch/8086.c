@@ -29,6 +29,8 @@
 #include "../optims.h"
 #include "../translator.h"
 
+static void block(FILE *file, BFi_instr_t *instr);
+
 void BFa_8086_t(FILE *file) {
 	fprintf(file, "\tbits\t16\n");
 	fprintf(file, "\torg\t100h\n\n");
@@ -161,19 +163,29 @@ next:	for(BFi_instr_t *instr = BFi_code; instr; instr = instr -> next) {
 			break;
 
 		case BFI_INSTR_LOOP:
-			fprintf(file, "\n.l%zu:\n", op1);
-			fprintf(file, "\tcmp\tbyte [si], 0\n");
+			fprintf(file, "\tcmp\tbyte ");
+			if(ad1 > 0) fprintf(file, "[si+%zd], 0\n", ad1);
+			else if(ad1 < 0) fprintf(file, "[si-%zd], 0\n", -ad1);
+			else fprintf(file, "[si], 0\n");
 			fprintf(file, "\tje\t.e%zu\n", op1);
+			fprintf(file, "\n.l%zu:\n", op1);
 			break;
 
 		case BFI_INSTR_ENDL:
-			fprintf(file, "\tjmp\t.l%zu\n", op1);
+			fprintf(file, "\tcmp\tbyte ");
+			if(ad1 > 0) fprintf(file, "[si+%zd], 0\n", ad1);
+			else if(ad1 < 0) fprintf(file, "[si-%zd], 0\n", -ad1);
+			else fprintf(file, "[si], 0\n");
+			fprintf(file, "\tjne\t.l%zu\n", op1);
 			fprintf(file, "\n.e%zu:\n", op1);
 			break;
 
 		case BFI_INSTR_IFNZ:
 			fprintf(file, "\n.l%zu:\n", op1);
-			fprintf(file, "\tcmp\tbyte [si], 0\n");
+			fprintf(file, "\tcmp\tbyte ");
+			if(ad1 > 0) fprintf(file, "[si+%zd], 0\n", ad1);
+			else if(ad1 < 0) fprintf(file, "[si-%zd], 0\n", -ad1);
+			else fprintf(file, "[si], 0\n");
 			fprintf(file, "\tje\t.e%zu\n", op1);
 			break;
 
@@ -181,8 +193,23 @@ next:	for(BFi_instr_t *instr = BFi_code; instr; instr = instr -> next) {
 			fprintf(file, "\n.e%zu:\n", op1);
 			break;
 
+		case BFI_INSTR_SCAN:
+			if(ad1 > 0) fprintf(file, "\tsub\tsi, %zd\n", ad1);
+			else fprintf(file, "\tadd\tsi, %zd\n", -ad1);
+
+			fprintf(file, "\n.l%zu:\n", op1);
+			if(ad1 > 0) fprintf(file, "\tadd\tsi, %zd\n", ad1);
+			else fprintf(file, "\tsub\tsi, %zd\n", -ad1);
+
+			fprintf(file, "\tcmp\tbyte [si], 0\n");
+			fprintf(file, "\tjne\t.l%zu\n", op1);
+			break;
+
 		case BFI_INSTR_CMPL:
-			fprintf(file, "\tneg\tbyte [si]\n");
+			fprintf(file, "\tneg\tbyte ");
+			if(ad1 > 0) fprintf(file, "[si+%zd]\n", ad1);
+			else if(ad1 < 0) fprintf(file, "[si-%zd]\n", -ad1);
+			else fprintf(file, "[si]\n");
 			break;
 
 		case BFI_INSTR_MOV:
@@ -325,6 +352,27 @@ next:	for(BFi_instr_t *instr = BFi_code; instr; instr = instr -> next) {
 			else fprintf(file, "[si]\n");
 			goto mulm;
 
+		case BFI_INSTR_PRDA:
+			fprintf(file, "\tmov\tal, ");
+			if(ad2 > 0) fprintf(file, "[si+%zd]\n", ad2);
+			else if(ad2 < 0) fprintf(file, "[si-%zd]\n", -ad2);
+			else fprintf(file, "[si]\n");
+
+			fprintf(file, "\tmov\tcl, ");
+			if((ssize_t) op2 > 0) fprintf(file, "[si+%zd]\n", (ssize_t) op2);
+			else if((ssize_t) op2 < 0) fprintf(file, "[si-%zd]\n", -op2);
+			else fprintf(file, "[si]\n");
+			fprintf(file, "\tmul\tcl\n");
+
+			if(op1 == 1) goto mula;
+			fprintf(file, "\tmov\tcl, %zu\n", op1);
+			fprintf(file, "\tmul\tcl\n");
+			goto mula;
+
+		case BFI_INSTR_SETB: case BFI_INSTR_ADDB:
+			block(file, instr);
+			break;
+
 		case BFI_INSTR_SUB:
 			fprintf(file, "\n_%zu:\n", op1);
 			break;
@@ -369,4 +417,28 @@ cells:	if(BFo_precomp_output) {
 	}
 
 	fprintf(file, "0\n");
-}
\ No newline at end of file
+}
+/* Blocks are stored a word at a time and added to a byte at a time. */
+
+static void block(FILE *file, BFi_instr_t *instr) {
+	size_t i = 0, len = instr -> op1, off = instr -> op2;
+	bool set = instr -> opcode == BFI_INSTR_SETB;
+
+	for(; i < len; i++) {
+		unsigned value = BFo_blocks[off + i];
+		ssize_t ad = instr -> ad1 + i;
+
+		if(set && len - i >= 2) {
+			value |= BFo_blocks[off + ++i] << 8;
+			fprintf(file, "\tmov\tword ");
+		}
+
+		else if(set) fprintf(file, "\tmov\tbyte ");
+		else if(value) fprintf(file, "\tadd\tbyte ");
+		else continue;
+
+		if(ad > 0) fprintf(file, "[si+%zd], %u\n", ad, value);
+		else if(ad < 0) fprintf(file, "[si-%zd], %u\n", -ad, value);
+		else fprintf(file, "[si], %u\n", value);
+	}
+}
@@ -29,6 +29,32 @@
 #include "../optims.h"
 #include "../translator.h"
 
+#define IO_SIZE 65536
+
+#define CACHE_REGS 7
+#define CACHE_CELLS 64
+#define CACHE_SPAN 256
+
+static const char *cache_regs[CACHE_REGS] = {
+	"%r8b", "%r9b", "%r10b", "%r11b", "%r13b", "%r14b", "%r15b"
+};
+
+static ssize_t cache_cells[CACHE_REGS];
+static size_t cache_count;
+static size_t cache_left;
+static bool cache_written[CACHE_REGS];
+static bool caching;
+
+static bool cacheable(BFi_instr_t *instr);
+static void cache_load(FILE *file, BFi_instr_t *instr);
+static void cache_store(FILE *file);
+static const char *cell(ssize_t ad);
+
+static bool innermost(BFi_instr_t *instr);
+static void tasm_block(FILE *file, BFi_instr_t *instr);
+static void tasm_runtime(FILE *file);
+static void tc_block(FILE *file, BFi_instr_t *instr);
+
 void BFa_amd64_tasm(FILE *file) {
 	if(BFo_precomp_output) {
 		fprintf(file, "\t.data\n");
@@ -87,36 +113,39 @@ n2:	fprintf(file, "\t.text\n");
 	
 	if(!BFo_precomp_ptr) fprintf(file, "\tmov\t$cells, %%rbx\n");
 	else fprintf(file, "\tmov\t$(cells + %zu), %%rbx\n", BFo_precomp_ptr);
+	fprintf(file, "\tmov\t$output, %%r12\n");
 
-	int last_io_instr = BFI_INSTR_NOP;
-	bool regs_dirty = true;
 	bool done_ret = false;
 
 	for(BFi_instr_t *instr = BFi_code; instr; instr = instr -> next) {
 		size_t op1 = instr -> op1, op2 = instr -> op2;
 		ssize_t ad1 = instr -> ad1, ad2 = instr -> ad2;
 
+		if(caching && (!cache_left || !cacheable(instr)))
+			cache_store(file);
+
+		if(!caching && cacheable(instr)) cache_load(file, instr);
+		if(caching) cache_left--;
+
 		switch(instr -> opcode) {
 		case BFI_INSTR_INC:
 			fprintf(file, "\taddb\t$%zu, ", op1);
-			if(ad1) fprintf(file, "%zd(%%rbx)\n", ad1);
-			else fprintf(file, "(%%rbx)\n");
+			fprintf(file, "%s\n", cell(ad1));
 			break;
 
 		case BFI_INSTR_DEC:
 			fprintf(file, "\tsubb\t$%zu, ", op1);
-			if(ad1) fprintf(file, "%zd(%%rbx)\n", ad1);
-			else fprintf(file, "(%%rbx)\n");
+			fprintf(file, "%s\n", cell(ad1));
 			break;
 
 		case BFI_INSTR_CMPL:
-			fprintf(file, "\tnegb\t(%%rbx)\n");
+			fprintf(file, "\tnegb\t");
+			fprintf(file, "%s\n", cell(ad1));
 			break;
 
 		case BFI_INSTR_MOV:
 			fprintf(file, "\tmovb\t$%zu, ", op1);
-			if(ad1) fprintf(file, "%zd(%%rbx)\n", ad1);
-			else fprintf(file, "(%%rbx)\n");
+			fprintf(file, "%s\n", cell(ad1));
 			break;
 
 		case BFI_INSTR_FWD:
@@ -128,61 +157,42 @@ n2:	fprintf(file, "\t.text\n");
 			break;
 
 		case BFI_INSTR_INP:
-			if(ad1) fprintf(file, "\tlea\t%zd", ad1);
-			else fprintf(file, "\tlea\t");
-			fprintf(file, "(%%rbx), %%rsi\n");
-
-			if(regs_dirty) fprintf(file, "\tmov\t$1, %%rdx\n");
-			else if(last_io_instr == BFI_INSTR_INP) goto in;
-
-			fprintf(file, "\tmov\t$0, %%rax\n");
-			fprintf(file, "\tmov\t%%rax, %%rdi\n");
-		in:	fprintf(file, "\tsyscall\n");
-
-			last_io_instr = BFI_INSTR_INP;
-			regs_dirty = false;
+			fprintf(file, "\tcall\tgetc\n");
+			fprintf(file, "\tjc\t1f\n");
+			fprintf(file, "\tmovb\t%%al, ");
+			fprintf(file, "%s\n", cell(ad1));
+			fprintf(file, "1:\n");
 			break;
 
 		case BFI_INSTR_OUT:
-			if(ad1) fprintf(file, "\tlea\t%zd", ad1);
-			else fprintf(file, "\tlea\t");
-			fprintf(file, "(%%rbx), %%rsi\n");
-
-			if(regs_dirty) {
-				fprintf(file, "\tmov\t$1, %%rdx\n");
-				fprintf(file, "\tmov\t%%rdx, %%rax\n");
-			}
-
-			else {
-				if(last_io_instr == BFI_INSTR_OUT) goto out;
-				fprintf(file, "\tmov\t$1, %%rax\n");
-			}
-
-			fprintf(file, "\tmov\t%%rax, %%rdi\n");
-		out:	fprintf(file, "\tsyscall\n");
-
-			last_io_instr = BFI_INSTR_OUT;
-			regs_dirty = false;
+			fprintf(file, "\tmovb\t");
+			fprintf(file, "%s, %%al\n", cell(ad1));
+
+			fprintf(file, "\tmovb\t%%al, (%%r12)\n");
+			fprintf(file, "\tinc\t%%r12\n");
+			fprintf(file, "\tcmp\t$(output + %d), %%r12\n", IO_SIZE);
+			fprintf(file, "\tjb\t1f\n");
+			fprintf(file, "\tcall\tflush\n");
+			fprintf(file, "1:\n");
 			break;
 
 		case BFI_INSTR_LOOP:
-			fprintf(file, "\n.L%zu:\n", op1);
-			fprintf(file, "\tcmpb\t$0, (%%rbx)\n");
-			fprintf(file, "\tje\t.LE%zu\n", op1);
-			
-			regs_dirty = true;
+			fprintf(file, "\tcmpb\t$0, %s\n", cell(ad1));
+			fprintf(file, "\tje\t.LE%zu\n\n", op1);
+
+			if(innermost(instr)) fprintf(file, "\t.p2align\t4,,10\n");
+			fprintf(file, ".L%zu:\n", op1);
 			break;
 
 		case BFI_INSTR_ENDL:
-			fprintf(file, "\tjmp\t.L%zu\n", op1);
+			fprintf(file, "\tcmpb\t$0, %s\n", cell(ad1));
+			fprintf(file, "\tjne\t.L%zu\n", op1);
 			fprintf(file, "\n.LE%zu:\n", op1);
-			
-			regs_dirty = true;
 			break;
 
 		case BFI_INSTR_IFNZ:
 			fprintf(file, "\n.L%zu:\n", op1);
-			fprintf(file, "\tcmpb\t$0, (%%rbx)\n");
+			fprintf(file, "\tcmpb\t$0, %s\n", cell(ad1));
 			fprintf(file, "\tje\t.LE%zu\n", op1);
 			break;
 
@@ -190,27 +200,86 @@ n2:	fprintf(file, "\t.text\n");
 			fprintf(file, "\n.LE%zu:\n", op1);
 			break;
 
+		case BFI_INSTR_SCAN:
+			if(ad1 != 1 && ad1 != -1) goto scan;
+
+			fprintf(file, "\tcmpb\t$0, (%%rbx)\n");
+			fprintf(file, "\tje\t.LE%zu\n", op1);
+			fprintf(file, "\tmov\t%%rbx, %%rdx\n");
+			fprintf(file, "\tand\t$-16, %%rdx\n");
+			fprintf(file, "\tmov\t%%ebx, %%ecx\n");
+			fprintf(file, "\tand\t$15, %%ecx\n");
+			if(ad1 < 0) fprintf(file, "\txor\t$31, %%ecx\n");
+
+			fprintf(file, "\tpxor\t%%xmm0, %%xmm0\n");
+			fprintf(file, "\tmovdqa\t(%%rdx), %%xmm1\n");
+			fprintf(file, "\tpcmpeqb\t%%xmm0, %%xmm1\n");
+			fprintf(file, "\tpmovmskb\t%%xmm1, %%eax\n");
+
+			if(ad1 > 0) fprintf(file, "\tshr\t%%cl, %%eax\n");
+			else fprintf(file, "\tshl\t%%cl, %%eax\n");
+
+			fprintf(file, "\ttest\t%%eax, %%eax\n");
+			fprintf(file, "\tjz\t.L%zu\n", op1);
+
+			if(ad1 > 0) {
+				fprintf(file, "\tbsf\t%%eax, %%eax\n");
+				fprintf(file, "\tadd\t%%rax, %%rbx\n");
+			}
+
+			else {
+				fprintf(file, "\tbsr\t%%eax, %%eax\n");
+				fprintf(file, "\tlea\t-31(%%rbx,%%rax), %%rbx\n");
+			}
+
+			fprintf(file, "\tjmp\t.LE%zu\n", op1);
+			fprintf(file, "\n.L%zu:\n", op1);
+
+			if(ad1 > 0) fprintf(file, "\tadd\t$16, %%rdx\n");
+			else fprintf(file, "\tsub\t$16, %%rdx\n");
+
+			fprintf(file, "\tmovdqa\t(%%rdx), %%xmm1\n");
+			fprintf(file, "\tpcmpeqb\t%%xmm0, %%xmm1\n");
+			fprintf(file, "\tpmovmskb\t%%xmm1, %%eax\n");
+			fprintf(file, "\ttest\t%%eax, %%eax\n");
+			fprintf(file, "\tjz\t.L%zu\n", op1);
+
+			if(ad1 > 0) fprintf(file, "\tbsf\t%%eax, %%eax\n");
+			else fprintf(file, "\tbsr\t%%eax, %%eax\n");
+
+			fprintf(file, "\tlea\t(%%rdx,%%rax), %%rbx\n");
+			fprintf(file, "\n.LE%zu:\n", op1);
+			break;
+
+		scan:	if(ad1 > 0) fprintf(file, "\tsub\t$%zd, %%rbx\n", ad1);
+			else fprintf(file, "\tadd\t$%zd, %%rbx\n", -ad1);
+
+			fprintf(file, "\n.L%zu:\n", op1);
+			if(ad1 > 0) fprintf(file, "\tadd\t$%zd, %%rbx\n", ad1);
+			else fprintf(file, "\tsub\t$%zd, %%rbx\n", -ad1);
+
+			fprintf(file, "\tcmpb\t$0, (%%rbx)\n");
+			fprintf(file, "\tjne\t.L%zu\n", op1);
+			break;
+
 		case BFI_INSTR_MULA:
 			if(instr -> prev -> opcode == BFI_INSTR_MULA
 				&& instr -> prev -> op1 == op1
-				&& instr -> prev -> ad1 == ad1) goto mula;
+				&& instr -> prev -> ad2 == ad2
+				&& instr -> prev -> ad1 != ad2) goto mula;
 
 			if(op1 == 3 || op1 == 5 || op1 == 9) goto lmula;
 
-			if(ad2) fprintf(file, "\tmov\t%zd(%%rbx), ", ad2);
-			else fprintf(file, "\tmov\t(%%rbx), ");
+			fprintf(file, "\tmov\t%s, ", cell(ad2));
 			fprintf(file, "%%al\n");
 
 			fprintf(file, "\tmov\t$%zu, %%cl\n", op1);
 			fprintf(file, "\tmul\t%%cl\n");
 		mula:	fprintf(file, "\taddb\t%%al, ");
-			if(ad1) fprintf(file, "%zd(%%rbx)\n", ad1);
-			else fprintf(file, "(%%rbx)\n");
-			regs_dirty = true;
+			fprintf(file, "%s\n", cell(ad1));
 			break;
 
-		lmula:	if(ad2) fprintf(file, "\tmovzb\t%zd(%%rbx), ", ad2);
-			else fprintf(file, "\tmovzb\t(%%rbx), ");
+		lmula:	fprintf(file, "\tmovzb\t%s, ", cell(ad2));
 			fprintf(file, "%%rax\n");
 			fprintf(file, "\tlea\t(%%rax,%%rax,%zu), %%rax\n",
 				op1 - 1);
@@ -219,24 +288,21 @@ n2:	fprintf(file, "\t.text\n");
 		case BFI_INSTR_MULS:
 			if(instr -> prev -> opcode == BFI_INSTR_MULS
 				&& instr -> prev -> op1 == op1
-				&& instr -> prev -> ad1 == ad1) goto muls;
+				&& instr -> prev -> ad2 == ad2
+				&& instr -> prev -> ad1 != ad2) goto muls;
 
 			if(op1 == 3 || op1 == 5 || op1 == 9) goto lmuls;
 
-			if(ad2) fprintf(file, "\tmov\t%zd(%%rbx), ", ad2);
-			else fprintf(file, "\tmov\t(%%rbx), ");
+			fprintf(file, "\tmov\t%s, ", cell(ad2));
 			fprintf(file, "%%al\n");
 
 			fprintf(file, "\tmov\t$%zu, %%cl\n", op1);
 			fprintf(file, "\tmul\t%%cl\n");
 		muls:	fprintf(file, "\tsubb\t%%al, ");
-			if(ad1) fprintf(file, "%zd(%%rbx)\n", ad1);
-			else fprintf(file, "(%%rbx)\n");
-			regs_dirty = true;
+			fprintf(file, "%s\n", cell(ad1));
 			break;
 
-		lmuls:	if(ad2) fprintf(file, "\tmovzb\t%zd(%%rbx), ", ad2);
-			else fprintf(file, "\tmovzb\t(%%rbx), ");
+		lmuls:	fprintf(file, "\tmovzb\t%s, ", cell(ad2));
 			fprintf(file, "%%rax\n");
 			fprintf(file, "\tlea\t(%%rax,%%rax,%zu), %%rax\n",
 				op1 - 1);
@@ -246,24 +312,21 @@ n2:	fprintf(file, "\t.text\n");
 			if((instr -> prev -> opcode == BFI_INSTR_MULM
 				|| instr -> prev -> opcode == BFI_INSTR_MULA)
 				&& instr -> prev -> op1 == op1
-				&& instr -> prev -> ad1 == ad1) goto mulm;
+				&& instr -> prev -> ad2 == ad2
+				&& instr -> prev -> ad1 != ad2) goto mulm;
 
 			if(op1 == 3 || op1 == 5 || op1 == 9) goto lmulm;
 
-			if(ad2) fprintf(file, "\tmov\t%zd(%%rbx), ", ad2);
-			else fprintf(file, "\tmov\t(%%rbx), ");
+			fprintf(file, "\tmov\t%s, ", cell(ad2));
 			fprintf(file, "%%al\n");
 
 			fprintf(file, "\tmov\t$%zu, %%cl\n", op1);
 			fprintf(file, "\tmul\t%%cl\n");
 		mulm:	fprintf(file, "\tmovb\t%%al, ");
-			if(ad1) fprintf(file, "%zd(%%rbx)\n", ad1);
-			else fprintf(file, "(%%rbx)\n");
-			regs_dirty = true;
+			fprintf(file, "%s\n", cell(ad1));
 			break;
 
-		lmulm:	if(ad2) fprintf(file, "\tmovzb\t%zd(%%rbx), ", ad2);
-			else fprintf(file, "\tmovzb\t(%%rbx), ");
+		lmulm:	fprintf(file, "\tmovzb\t%s, ", cell(ad2));
 			fprintf(file, "%%rax\n");
 			fprintf(file, "\tlea\t(%%rax,%%rax,%zu), %%rax\n",
 				op1 - 1);
@@ -272,7 +335,8 @@ n2:	fprintf(file, "\t.text\n");
 		case BFI_INSTR_SHLA:
 			if(instr -> prev -> opcode == BFI_INSTR_SHLA
 				&& instr -> prev -> op2 == op2
-				&& instr -> prev -> ad1 == ad1) goto mula;
+				&& instr -> prev -> ad2 == ad2
+				&& instr -> prev -> ad1 != ad2) goto mula;
 
 			switch(op2) {
 				case 1: op1 = 2; goto lshla;
@@ -280,16 +344,14 @@ n2:	fprintf(file, "\t.text\n");
 				case 3: op1 = 8; goto lshla;
 			}
 
-			if(ad2) fprintf(file, "\tmov\t%zd(%%rbx), ", ad2);
-			else fprintf(file, "\tmov\t(%%rbx), ");
+			fprintf(file, "\tmov\t%s, ", cell(ad2));
 			fprintf(file, "%%al\n");
 
 			if(op2 == 1) fprintf(file, "\tshl\t%%al\n");
 			else fprintf(file, "\tshl\t$%zu, %%al\n", op2);
 			goto mula;
 
-		lshla:	if(ad2) fprintf(file, "\tmovzb\t%zd(%%rbx), ", ad2);
-			else fprintf(file, "\tmovzb\t(%%rbx), ");
+		lshla:	fprintf(file, "\tmovzb\t%s, ", cell(ad2));
 			fprintf(file, "%%rax\n");
 			fprintf(file, "\tlea\t(,%%rax,%zu), %%rax\n", op1);
 			goto mula;
@@ -297,7 +359,8 @@ n2:	fprintf(file, "\t.text\n");
 		case BFI_INSTR_SHLS:
 			if(instr -> prev -> opcode == BFI_INSTR_SHLS
 				&& instr -> prev -> op2 == op2
-				&& instr -> prev -> ad1 == ad1) goto muls;
+				&& instr -> prev -> ad2 == ad2
+				&& instr -> prev -> ad1 != ad2) goto muls;
 
 			switch(op2) {
 				case 1: op1 = 2; goto lshls;
@@ -305,16 +368,14 @@ n2:	fprintf(file, "\t.text\n");
 				case 3: op1 = 8; goto lshls;
 			}
 
-			if(ad2) fprintf(file, "\tmov\t%zd(%%rbx), ", ad2);
-			else fprintf(file, "\tmov\t(%%rbx), ");
+			fprintf(file, "\tmov\t%s, ", cell(ad2));
 			fprintf(file, "%%al\n");
 
 			if(op2 == 1) fprintf(file, "\tshl\t%%al\n");
 			else fprintf(file, "\tshl\t$%zu, %%al\n", op2);
 			goto muls;
 
-		lshls:	if(ad2) fprintf(file, "\tmovzb\t%zd(%%rbx), ", ad2);
-			else fprintf(file, "\tmovzb\t(%%rbx), ");
+		lshls:	fprintf(file, "\tmovzb\t%s, ", cell(ad2));
 			fprintf(file, "%%rax\n");
 			fprintf(file, "\tlea\t(,%%rax,%zu), %%rax\n", op1);
 			goto muls;
@@ -323,7 +384,8 @@ n2:	fprintf(file, "\t.text\n");
 			if((instr -> prev -> opcode == BFI_INSTR_SHLM
 				|| instr -> prev -> opcode == BFI_INSTR_SHLA)
 				&& instr -> prev -> op2 == op2
-				&& instr -> prev -> ad1 == ad1) goto mulm;
+				&& instr -> prev -> ad2 == ad2
+				&& instr -> prev -> ad1 != ad2) goto mulm;
 
 			switch(op2) {
 				case 1: op1 = 2; goto lshlm;
@@ -331,16 +393,14 @@ n2:	fprintf(file, "\t.text\n");
 				case 3: op1 = 8; goto lshlm;
 			}
 
-			if(ad2) fprintf(file, "\tmov\t%zd(%%rbx), ", ad2);
-			else fprintf(file, "\tmov\t(%%rbx), ");
+			fprintf(file, "\tmov\t%s, ", cell(ad2));
 			fprintf(file, "%%al\n");
 
 			if(op2 == 1) fprintf(file, "\tshl\t%%al\n");
 			else fprintf(file, "\tshl\t$%zu, %%al\n", op2);
 			goto mulm;
 
-		lshlm:	if(ad2) fprintf(file, "\tmovzb\t%zd(%%rbx), ", ad2);
-			else fprintf(file, "\tmovzb\t(%%rbx), ");
+		lshlm:	fprintf(file, "\tmovzb\t%s, ", cell(ad2));
 			fprintf(file, "%%rax\n");
 			fprintf(file, "\tlea\t(,%%rax,%zu), %%rax\n", op1);
 			goto mulm;
@@ -348,20 +408,20 @@ n2:	fprintf(file, "\t.text\n");
 		case BFI_INSTR_CPYA:
 			if(instr -> prev -> opcode == BFI_INSTR_CPYA
 				&& instr -> prev -> op1 == op1
-				&& instr -> prev -> ad1 == ad1) goto mula;
+				&& instr -> prev -> ad2 == ad2
+				&& instr -> prev -> ad1 != ad2) goto mula;
 
-			if(ad2) fprintf(file, "\tmov\t%zd(%%rbx), ", ad2);
-			else fprintf(file, "\tmov\t(%%rbx), ");
+			fprintf(file, "\tmov\t%s, ", cell(ad2));
 			fprintf(file, "%%al\n");
 			goto mula;
 
 		case BFI_INSTR_CPYS:
 			if(instr -> prev -> opcode == BFI_INSTR_CPYS
 				&& instr -> prev -> op1 == op1
-				&& instr -> prev -> ad1 == ad1) goto muls;
+				&& instr -> prev -> ad2 == ad2
+				&& instr -> prev -> ad1 != ad2) goto muls;
 
-			if(ad2) fprintf(file, "\tmov\t%zd(%%rbx), ", ad2);
-			else fprintf(file, "\tmov\t(%%rbx), ");
+			fprintf(file, "\tmov\t%s, ", cell(ad2));
 			fprintf(file, "%%al\n");
 			goto muls;
 
@@ -369,29 +429,39 @@ n2:	fprintf(file, "\t.text\n");
 			if((instr -> prev -> opcode == BFI_INSTR_CPYM
 				|| instr -> prev -> opcode == BFI_INSTR_CPYA)
 				&& instr -> prev -> op1 == op1
-				&& instr -> prev -> ad1 == ad1) goto mulm;
+				&& instr -> prev -> ad2 == ad2
+				&& instr -> prev -> ad1 != ad2) goto mulm;
 
-			if(ad2) fprintf(file, "\tmov\t%zd(%%rbx), ", ad2);
-			else fprintf(file, "\tmov\t(%%rbx), ");
+			fprintf(file, "\tmov\t%s, ", cell(ad2));
 			fprintf(file, "%%al\n");
 			goto mulm;
 
+		case BFI_INSTR_PRDA:
+			fprintf(file, "\tmovzb\t%s, %%rax\n", cell(ad2));
+			fprintf(file, "\tmovzb\t%s, %%rcx\n", cell((ssize_t) op2));
+			fprintf(file, "\timul\t%%rcx, %%rax\n");
+
+			if(op1 != 1) fprintf(file, "\timul\t$%zu, %%rax\n", op1);
+			goto mula;
+
+		case BFI_INSTR_SETB: case BFI_INSTR_ADDB:
+			tasm_block(file, instr);
+			break;
+
 		case BFI_INSTR_SUB:
 			fprintf(file, "\n_%zu:\n", op1);
-			regs_dirty = true;
 			break;
 
 		case BFI_INSTR_JSR:
 			fprintf(file, "\tcall\t_%zu\n", op1);
-			regs_dirty = true;
 			break;
 
 		case BFI_INSTR_RTS:
 			fprintf(file, "\tret\n");
-			regs_dirty = true;
 			break;
 
 		case BFI_INSTR_RET:
+			fprintf(file, "\tcall\tflush\n");
 			fprintf(file, "\tmov\t$60, %%rax\n");
 			fprintf(file, "\tmov\t$0, %%rdi\n");
 			fprintf(file, "\tsyscall\n");
@@ -399,12 +469,253 @@ n2:	fprintf(file, "\t.text\n");
 		}
 	}
 
-	if(done_ret) return;
+	if(caching) cache_store(file);
+	if(done_ret) goto runtime;
+
+	fprintf(file, "\tcall\tflush\n");
+	fprintf(file, "\tmov\t$60, %%rax\n");
+	fprintf(file, "\tmov\t$0, %%rdi\n");
+	fprintf(file, "\tsyscall\n");
+
+runtime:	tasm_runtime(file);
+	return;
+
 end:	fprintf(file, "\tmov\t$60, %%rax\n");
 	fprintf(file, "\tmov\t$0, %%rdi\n");
 	fprintf(file, "\tsyscall\n");
 }
 
+/* Straight-line runs of arithmetic are given a register for each of their
+ * most used cells, provided that a cell is used often enough to pay for the
+ * extra load and store. The registers are loaded at the start of the run, unless
+ * the first access overwrites the cell, and stored back at its end, before
+ * any loop edge, I/O, pointer move or subroutine call. */
+
+static bool cacheable(BFi_instr_t *instr) {
+	switch(instr -> opcode) {
+	case BFI_INSTR_INC: case BFI_INSTR_DEC:
+	case BFI_INSTR_CMPL: case BFI_INSTR_MOV:
+	case BFI_INSTR_MULA: case BFI_INSTR_MULS: case BFI_INSTR_MULM:
+	case BFI_INSTR_SHLA: case BFI_INSTR_SHLS: case BFI_INSTR_SHLM:
+	case BFI_INSTR_CPYA: case BFI_INSTR_CPYS: case BFI_INSTR_CPYM:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+static void cache_load(FILE *file, BFi_instr_t *instr) {
+	ssize_t cells[CACHE_CELLS];
+	size_t uses[CACHE_CELLS], count = 0;
+	bool loads[CACHE_CELLS], writes[CACHE_CELLS];
+
+	caching = true;
+	cache_left = 0;
+	cache_count = 0;
+
+	for(; instr && cacheable(instr) && cache_left < CACHE_SPAN;
+		instr = instr -> next, cache_left++)
+	{
+		bool reads = true;
+
+		switch(instr -> opcode) {
+		case BFI_INSTR_MOV: case BFI_INSTR_MULM:
+		case BFI_INSTR_SHLM: case BFI_INSTR_CPYM:
+			reads = false;
+		}
+
+		for(int j = 0; j < 2; j++) {
+			ssize_t ad = j? instr -> ad2 : instr -> ad1;
+			if(j && (instr -> opcode == BFI_INSTR_INC
+				|| instr -> opcode == BFI_INSTR_DEC
+				|| instr -> opcode == BFI_INSTR_CMPL
+				|| instr -> opcode == BFI_INSTR_MOV)) break;
+
+			size_t i;
+			for(i = 0; i < count && cells[i] != ad; i++);
+
+			if(i == count) {
+				if(count == CACHE_CELLS) continue;
+
+				cells[count] = ad;
+				uses[count] = 0;
+				loads[count] = j || reads;
+				writes[count++] = false;
+			}
+
+			uses[i]++;
+			if(!j) writes[i] = true;
+		}
+	}
+
+	while(cache_count < CACHE_REGS) {
+		size_t best = count;
+
+		for(size_t i = 0; i < count; i++) {
+			if(uses[i] < 3) continue;
+			if(best == count || uses[i] > uses[best]) best = i;
+		}
+
+		if(best == count) break;
+
+		cache_cells[cache_count] = cells[best];
+		cache_written[cache_count] = writes[best];
+		uses[best] = 0;
+
+		if(loads[best]) {
+			fprintf(file, "	movb	%s, ", cell(cells[best]));
+			fprintf(file, "%s\n", cache_regs[cache_count]);
+		}
+
+		cache_count++;
+	}
+}
+
+static void cache_store(FILE *file) {
+	size_t count = cache_count;
+	caching = false;
+	cache_count = 0;
+
+	for(size_t i = 0; i < count; i++) {
+		if(!cache_written[i]) continue;
+
+		fprintf(file, "	movb	%s, ", cache_regs[i]);
+		fprintf(file, "%s\n", cell(cache_cells[i]));
+	}
+}
+
+static const char *cell(ssize_t ad) {
+	static char buf[32];
+
+	for(size_t i = 0; i < cache_count; i++)
+		if(cache_cells[i] == ad) return cache_regs[i];
+
+	if(ad) sprintf(buf, "%zd(%%rbx)", ad);
+	else sprintf(buf, "(%%rbx)");
+	return buf;
+}
+
+/* Output is collected in a buffer that is written out when it fills up,
+ * before every read and at exit. Input is read in blocks of the same size,
+ * and getc sets the carry flag at the end of the input so that the cell is
+ * left unchanged, as with a single-byte read. */
+
+/* Loops are rotated so that each iteration only tests the cell at the bottom,
+ * and the heads of loops without any nested loops or calls are aligned. */
+
+static bool innermost(BFi_instr_t *instr) {
+	for(instr = instr -> next; instr; instr = instr -> next) {
+		switch(instr -> opcode) {
+		case BFI_INSTR_LOOP: case BFI_INSTR_JSR:
+			return false;
+
+		case BFI_INSTR_ENDL:
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Block operations go through xmm registers 16, 8 and then 4 bytes at a
+ * time, reading from the table at blocks, and finish with single bytes. */
+
+static void tasm_block(FILE *file, BFi_instr_t *instr) {
+	static const char *loads[] = {"movdqa", "movq", "movd"};
+	static const char *moves[] = {"movdqu", "movq", "movd"};
+
+	size_t i = 0, len = instr -> op1, off = instr -> op2;
+	ssize_t ad1 = instr -> ad1;
+
+	for(size_t j = 0, size = 16; size >= 4; j++, size /= 2) {
+		for(; len - i >= size; i += size) {
+			fprintf(file, "\t%s\tblocks + %zu, %%xmm1\n", loads[j],
+				off + i);
+
+			if(instr -> opcode == BFI_INSTR_SETB) {
+				fprintf(file, "\t%s\t%%xmm1, ", moves[j]);
+				fprintf(file, "%s\n", cell(ad1 + i));
+				continue;
+			}
+
+			fprintf(file, "\t%s\t%s, %%xmm0\n", moves[j],
+				cell(ad1 + i));
+			fprintf(file, "\tpaddb\t%%xmm1, %%xmm0\n");
+			fprintf(file, "\t%s\t%%xmm0, ", moves[j]);
+			fprintf(file, "%s\n", cell(ad1 + i));
+		}
+	}
+
+	for(; i < len; i++) {
+		unsigned char value = BFo_blocks[off + i];
+
+		if(instr -> opcode == BFI_INSTR_SETB)
+			fprintf(file, "\tmovb\t$%d, ", value);
+		else if(value) fprintf(file, "\taddb\t$%d, ", value);
+		else continue;
+
+		fprintf(file, "%s\n", cell(ad1 + i));
+	}
+}
+
+static void tasm_runtime(FILE *file) {
+	fprintf(file, "\nflush:\n");
+	fprintf(file, "\tmov\t$output, %%rsi\n");
+	fprintf(file, "1:\tmov\t%%r12, %%rdx\n");
+	fprintf(file, "\tsub\t%%rsi, %%rdx\n");
+	fprintf(file, "\tjbe\t2f\n");
+	fprintf(file, "\tmov\t$1, %%eax\n");
+	fprintf(file, "\tmov\t%%eax, %%edi\n");
+	fprintf(file, "\tsyscall\n");
+	fprintf(file, "\ttest\t%%rax, %%rax\n");
+	fprintf(file, "\tjle\t2f\n");
+	fprintf(file, "\tadd\t%%rax, %%rsi\n");
+	fprintf(file, "\tjmp\t1b\n");
+	fprintf(file, "2:\tmov\t$output, %%r12\n");
+	fprintf(file, "\tret\n");
+
+	fprintf(file, "\ngetc:\n");
+	fprintf(file, "\tmov\tinpos(%%rip), %%rsi\n");
+	fprintf(file, "\tcmp\tinend(%%rip), %%rsi\n");
+	fprintf(file, "\tjb\t1f\n");
+	fprintf(file, "\tcall\tflush\n");
+	fprintf(file, "\txor\t%%eax, %%eax\n");
+	fprintf(file, "\txor\t%%edi, %%edi\n");
+	fprintf(file, "\tmov\t$input, %%esi\n");
+	fprintf(file, "\tmov\t$%d, %%edx\n", IO_SIZE);
+	fprintf(file, "\tsyscall\n");
+	fprintf(file, "\ttest\t%%rax, %%rax\n");
+	fprintf(file, "\tjle\t2f\n");
+	fprintf(file, "\tadd\t%%rsi, %%rax\n");
+	fprintf(file, "\tmov\t%%rax, inend(%%rip)\n");
+	fprintf(file, "1:\tmovb\t(%%rsi), %%al\n");
+	fprintf(file, "\tinc\t%%rsi\n");
+	fprintf(file, "\tmov\t%%rsi, inpos(%%rip)\n");
+	fprintf(file, "\tclc\n");
+	fprintf(file, "\tret\n");
+	fprintf(file, "2:\tstc\n");
+	fprintf(file, "\tret\n");
+
+	if(BFo_blocks_size) {
+		fprintf(file, "\n\t.data\n");
+		fprintf(file, "\t.p2align\t4\n");
+		fprintf(file, "blocks:");
+
+		for(size_t i = 0; i < BFo_blocks_size; i++) {
+			if(i % 8) fprintf(file, ", %d", BFo_blocks[i]);
+			else fprintf(file, "\t.byte\t%d", BFo_blocks[i]);
+			if(i % 8 == 7) fprintf(file, "\n");
+		}
+	}
+
+	fprintf(file, "\n\t.bss\n");
+	fprintf(file, "inpos:\t.skip\t8\n");
+	fprintf(file, "inend:\t.skip\t8\n");
+	fprintf(file, "input:\t.skip\t%d\n", IO_SIZE);
+	fprintf(file, "output:\t.skip\t%d\n", IO_SIZE);
+}
+
 void BFa_amd64_tc(FILE *file) {
 	fprintf(file, "\tasm volatile (\n");
 	fprintf(file, "\t\"\tmov\t%%0, %%%%rbx\\n\"\n");
@@ -476,21 +787,32 @@ void BFa_amd64_tc(FILE *file) {
 			break;
 
 		case BFI_INSTR_LOOP:
-			fprintf(file, "\n\t\".L%zu:\\n\"\n", op1);
-			fprintf(file, "\t\"\tcmpb\t$0, (%%%%rbx)\\n\"\n");
+			fprintf(file, "\t\"\tcmpb\t$0, ");
+			if(ad1) fprintf(file, "%zd(%%%%rbx)\\n\"\n", ad1);
+			else fprintf(file, "(%%%%rbx)\\n\"\n");
 			fprintf(file, "\t\"\tje\t.LE%zu\\n\"\n", op1);
+
+			if(innermost(instr))
+				fprintf(file, "\t\"\t.p2align\t4,,10\\n\"\n");
+
+			fprintf(file, "\n\t\".L%zu:\\n\"\n", op1);
 			regs_dirty = true;
 			break;
 
 		case BFI_INSTR_ENDL:
-			fprintf(file, "\t\"\tjmp\t.L%zu\\n\"\n", op1);
+			fprintf(file, "\t\"\tcmpb\t$0, ");
+			if(ad1) fprintf(file, "%zd(%%%%rbx)\\n\"\n", ad1);
+			else fprintf(file, "(%%%%rbx)\\n\"\n");
+			fprintf(file, "\t\"\tjne\t.L%zu\\n\"\n", op1);
 			fprintf(file, "\n\t\".LE%zu:\\n\"\n", op1);
 			regs_dirty = true;
 			break;
 
 		case BFI_INSTR_IFNZ:
 			fprintf(file, "\n\t\".L%zu:\\n\"\n", op1);
-			fprintf(file, "\t\"\tcmpb\t$0, (%%%%rbx)\\n\"\n");
+			fprintf(file, "\t\"\tcmpb\t$0, ");
+			if(ad1) fprintf(file, "%zd(%%%%rbx)\\n\"\n", ad1);
+			else fprintf(file, "(%%%%rbx)\\n\"\n");
 			fprintf(file, "\t\"\tje\t.LE%zu\\n\"\n", op1);
 			break;
 
@@ -499,7 +821,9 @@ void BFa_amd64_tc(FILE *file) {
 			break;
 
 		case BFI_INSTR_CMPL:
-			fprintf(file, "\t\"\tnegb\t(%%%%rbx)\\n\"\n");
+			fprintf(file, "\t\"\tnegb\t");
+			if(ad1) fprintf(file, "%zd(%%%%rbx)\\n\"\n", ad1);
+			else fprintf(file, "(%%%%rbx)\\n\"\n");
 			break;
 
 		case BFI_INSTR_MOV:
@@ -508,6 +832,72 @@ void BFa_amd64_tc(FILE *file) {
 			else fprintf(file, "(%%%%rbx)\\n\"\n");
 			break;
 
+		case BFI_INSTR_SCAN:
+			if(ad1 != 1 && ad1 != -1) goto scan;
+
+			fprintf(file, "\t\"\tcmpb\t$0, (%%%%rbx)\\n\"\n");
+			fprintf(file, "\t\"\tje\t.LE%zu\\n\"\n", op1);
+			fprintf(file, "\t\"\tmov\t%%%%rbx, %%%%rdx\\n\"\n");
+			fprintf(file, "\t\"\tand\t$-16, %%%%rdx\\n\"\n");
+			fprintf(file, "\t\"\tmov\t%%%%ebx, %%%%ecx\\n\"\n");
+			fprintf(file, "\t\"\tand\t$15, %%%%ecx\\n\"\n");
+			if(ad1 < 0) fprintf(file, "\t\"\txor\t$31, %%%%ecx\\n\"\n");
+
+			fprintf(file, "\t\"\tpxor\t%%%%xmm0, %%%%xmm0\\n\"\n");
+			fprintf(file, "\t\"\tmovdqa\t(%%%%rdx), %%%%xmm1\\n\"\n");
+			fprintf(file, "\t\"\tpcmpeqb\t%%%%xmm0, %%%%xmm1\\n\"\n");
+			fprintf(file, "\t\"\tpmovmskb\t%%%%xmm1, %%%%eax\\n\"\n");
+
+			if(ad1 > 0) fprintf(file, "\t\"\tshr\t%%%%cl, %%%%eax\\n\"\n");
+			else fprintf(file, "\t\"\tshl\t%%%%cl, %%%%eax\\n\"\n");
+
+			fprintf(file, "\t\"\ttest\t%%%%eax, %%%%eax\\n\"\n");
+			fprintf(file, "\t\"\tjz\t.L%zu\\n\"\n", op1);
+
+			if(ad1 > 0) {
+				fprintf(file, "\t\"\tbsf\t%%%%eax, %%%%eax\\n\"\n");
+				fprintf(file, "\t\"\tadd\t%%%%rax, %%%%rbx\\n\"\n");
+			}
+
+			else {
+				fprintf(file, "\t\"\tbsr\t%%%%eax, %%%%eax\\n\"\n");
+				fprintf(file,
+					"\t\"\tlea\t-31(%%%%rbx,%%%%rax), %%%%rbx\\n\"\n");
+			}
+
+			fprintf(file, "\t\"\tjmp\t.LE%zu\\n\"\n", op1);
+			fprintf(file, "\n\t\".L%zu:\\n\"\n", op1);
+
+			if(ad1 > 0) fprintf(file, "\t\"\tadd\t$16, %%%%rdx\\n\"\n");
+			else fprintf(file, "\t\"\tsub\t$16, %%%%rdx\\n\"\n");
+
+			fprintf(file, "\t\"\tmovdqa\t(%%%%rdx), %%%%xmm1\\n\"\n");
+			fprintf(file, "\t\"\tpcmpeqb\t%%%%xmm0, %%%%xmm1\\n\"\n");
+			fprintf(file, "\t\"\tpmovmskb\t%%%%xmm1, %%%%eax\\n\"\n");
+			fprintf(file, "\t\"\ttest\t%%%%eax, %%%%eax\\n\"\n");
+			fprintf(file, "\t\"\tjz\t.L%zu\\n\"\n", op1);
+
+			if(ad1 > 0) fprintf(file, "\t\"\tbsf\t%%%%eax, %%%%eax\\n\"\n");
+			else fprintf(file, "\t\"\tbsr\t%%%%eax, %%%%eax\\n\"\n");
+
+			fprintf(file, "\t\"\tlea\t(%%%%rdx,%%%%rax), %%%%rbx\\n\"\n");
+			fprintf(file, "\n\t\".LE%zu:\\n\"\n", op1);
+			regs_dirty = true;
+			break;
+
+		scan:	if(ad1 > 0) fprintf(file,
+				"\t\"\tsub\t$%zd, %%%%rbx\\n\"\n", ad1);
+			else fprintf(file, "\t\"\tadd\t$%zd, %%%%rbx\\n\"\n", -ad1);
+
+			fprintf(file, "\n\t\".L%zu:\\n\"\n", op1);
+			if(ad1 > 0) fprintf(file,
+				"\t\"\tadd\t$%zd, %%%%rbx\\n\"\n", ad1);
+			else fprintf(file, "\t\"\tsub\t$%zd, %%%%rbx\\n\"\n", -ad1);
+
+			fprintf(file, "\t\"\tcmpb\t$0, (%%%%rbx)\\n\"\n");
+			fprintf(file, "\t\"\tjne\t.L%zu\\n\"\n", op1);
+			break;
+
 		case BFI_INSTR_MULA:
 			if(instr -> prev -> opcode == BFI_INSTR_MULA
 				&& instr -> prev -> op1 == op1
@@ -700,6 +1090,26 @@ void BFa_amd64_tc(FILE *file) {
 			fprintf(file, "%%%%al\\n\"\n");
 			goto mulm;
 
+		case BFI_INSTR_PRDA:
+			if(ad2) fprintf(file, "\t\"\tmovzb\t%zd(%%%%rbx), ", ad2);
+			else fprintf(file, "\t\"\tmovzb\t(%%%%rbx), ");
+			fprintf(file, "%%%%rax\\n\"\n");
+
+			if(op2) fprintf(file, "\t\"\tmovzb\t%zd(%%%%rbx), ",
+				(ssize_t) op2);
+			else fprintf(file, "\t\"\tmovzb\t(%%%%rbx), ");
+			fprintf(file, "%%%%rcx\\n\"\n");
+
+			fprintf(file, "\t\"\timul\t%%%%rcx, %%%%rax\\n\"\n");
+			if(op1 != 1) fprintf(file,
+				"\t\"\timul\t$%zu, %%%%rax\\n\"\n", op1);
+			goto mula;
+
+		case BFI_INSTR_SETB: case BFI_INSTR_ADDB:
+			tc_block(file, instr);
+			regs_dirty = true;
+			break;
+
 		case BFI_INSTR_SUB:
 			fprintf(file, "\n\t\"_%zu:\\n\"\n", op1);
 			regs_dirty = true;
@@ -726,7 +1136,54 @@ void BFa_amd64_tc(FILE *file) {
 		BFo_mem_padding + BFo_precomp_ptr);
 	
 	fprintf(file, "\t:\t\"rax\", \"rbx\", \"rcx\", \"rdx\", \"rdi\",\n"
-		"\t\t\"rsi\", \"r8\", \"r9\", \"r10\", \"r11\"\n\t);\n\n");
+		"\t\t\"rsi\", \"r8\", \"r9\", \"r10\", \"r11\",\n"
+		"\t\t\"xmm0\", \"xmm1\"\n\t);\n\n");
 
 	fprintf(file, "\treturn 0;\n");
-}
\ No newline at end of file
+}
+/* Inline assembly can't see the table, so blocks are built up eight bytes at a
+ * time in rax, going through xmm registers for adds. */
+
+static void tc_block(FILE *file, BFi_instr_t *instr) {
+	size_t i = 0, len = instr -> op1, off = instr -> op2;
+
+	for(; len - i >= 8; i += 8) {
+		unsigned long long value = 0;
+		ssize_t ad = instr -> ad1 + i;
+
+		for(int j = 7; j >= 0; j--)
+			value = value << 8 | BFo_blocks[off + i + j];
+
+		fprintf(file, "\t\"\tmovabs\t$%llu, %%%%rax\\n\"\n", value);
+
+		if(instr -> opcode == BFI_INSTR_SETB) {
+			fprintf(file, "\t\"\tmov\t%%%%rax, ");
+			goto store;
+		}
+
+		fprintf(file, "\t\"\tmovq\t%%%%rax, %%%%xmm1\\n\"\n");
+
+		if(ad) fprintf(file, "\t\"\tmovq\t%zd(%%%%rbx), ", ad);
+		else fprintf(file, "\t\"\tmovq\t(%%%%rbx), ");
+		fprintf(file, "%%%%xmm0\\n\"\n");
+
+		fprintf(file, "\t\"\tpaddb\t%%%%xmm1, %%%%xmm0\\n\"\n");
+		fprintf(file, "\t\"\tmovq\t%%%%xmm0, ");
+
+	store:	if(ad) fprintf(file, "%zd(%%%%rbx)\\n\"\n", ad);
+		else fprintf(file, "(%%%%rbx)\\n\"\n");
+	}
+
+	for(; i < len; i++) {
+		unsigned char value = BFo_blocks[off + i];
+		ssize_t ad = instr -> ad1 + i;
+
+		if(instr -> opcode == BFI_INSTR_SETB)
+			fprintf(file, "\t\"\tmovb\t$%d, ", value);
+		else if(value) fprintf(file, "\t\"\taddb\t$%d, ", value);
+		else continue;
+
+		if(ad) fprintf(file, "%zd(%%%%rbx)\\n\"\n", ad);
+		else fprintf(file, "(%%%%rbx)\\n\"\n");
+	}
+}
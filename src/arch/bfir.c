@@ -89,21 +89,25 @@ void BFa_bfir_t(FILE *file) {
 			break;
 
 		case BFI_INSTR_LOOP:
-			fprintf(file, "\tloop\t#%zu\n", op1);
+			fprintf(file, "\tloop\t%%%zd, #%zu\n", ad1, op1);
 			break;
 
 		case BFI_INSTR_ENDL:
-			fprintf(file, "\tendl\t#%zu\n", op1);
+			fprintf(file, "\tendl\t%%%zd, #%zu\n", ad1, op1);
 			break;
 
 		case BFI_INSTR_IFNZ:
-			fprintf(file, "\tifnz\t#%zu\n", op1);
+			fprintf(file, "\tifnz\t%%%zd, #%zu\n", ad1, op1);
 			break;
 
 		case BFI_INSTR_ENDIF:
 			fprintf(file, "\tendif\t#%zu\n", op1);
 			break;
 
+		case BFI_INSTR_SCAN:
+			fprintf(file, "\tscan\t%zd\n", ad1);
+			break;
+
 		case BFI_INSTR_MULA:
 			fprintf(file, "\tmula\t%%%zd, %%%zd, %zu\n",
 				ad1, ad2, op1);
@@ -146,6 +150,30 @@ void BFa_bfir_t(FILE *file) {
 			fprintf(file, "\tcpym\t%%%zd, %%%zd\n", ad1, ad2);
 			break;
 
+		case BFI_INSTR_PRDA:
+			fprintf(file, "\tprda\t%%%zd, %%%zd, %%%zd, %zu\n",
+				ad1, ad2, (ssize_t) op2, op1);
+			break;
+
+		case BFI_INSTR_SETB: case BFI_INSTR_ADDB:
+			fprintf(file, instr -> opcode == BFI_INSTR_SETB ?
+				"\tsetb\t" : "\taddb\t");
+
+			size_t cols = 16;
+			char buf[16] = {0};
+
+			cols += fprintf(file, "%%%zd", ad1);
+
+			for(size_t i = 0; i < op1; i++) {
+				cols += sprintf(buf, ", %d", BFo_blocks[op2 + i]);
+				if(cols < 80) fprintf(file, "%s", buf);
+				else cols = fprintf(file, ",\n\t\t%s", buf + 2)
+					+ 13;
+			}
+
+			fprintf(file, "\n");
+			break;
+
 
 		case BFI_INSTR_SUB:
 			fprintf(file, "\n#%zu:", op1);
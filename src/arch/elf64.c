@@ -0,0 +1,533 @@
+/* Bfcli: The Interactive Brainfuck Command-Line Interpreter
+ * Copyright (C) 2021-2022 Jyothiraditya Nellakra
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <elf.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "elf64.h"
+
+#include "../errors.h"
+#include "../interpreter.h"
+#include "../optims.h"
+
+/* The executable is laid out the way ld would lay out the output of the
+ * amd64 backend, with the same register assignment and runtime:
+ *
+ *   %rbx: the cell pointer, %r12: the next free byte of the output buffer.
+ *
+ * The data segment comes first in the file so that every data address is
+ * known before any code is encoded. It holds the precomputed header and
+ * cells, followed by the rest of the tape and the I/O buffers as bss. The
+ * text segment maps the whole file and starts executing after the data. */
+
+#define BODY_SIZE 96
+#define STUB_SIZE 256
+#define IO_SIZE 65536
+
+#define TEXT_ADDR 0x400000
+#define DATA_ADDR 0x10000000
+#define PAGE_SIZE 0x1000
+
+#define HEADERS_SIZE (sizeof(Elf64_Ehdr) + 3 * sizeof(Elf64_Phdr))
+
+typedef struct {
+	size_t pos;
+	size_t target;
+
+} patch_t;
+
+static unsigned char *code;
+static size_t code_size;
+static size_t pos;
+
+static uint32_t header_addr, cells_addr;
+static uint32_t inpos_addr, inend_addr, input_addr, output_addr;
+static size_t flush_pos, getc_pos;
+
+static void emit(const char *bytes, size_t len);
+static void emit8(unsigned char byte);
+static void emit32(int32_t num);
+
+static void call(size_t target);
+static void mem(int reg, ssize_t ad);
+static void block(BFi_instr_t *instr);
+static void finish();
+static void runtime();
+
+void BFa_elf64_t(FILE *file) {
+	size_t length = BFo_precomp_output? strlen((char *) BFo_precomp_output) : 0;
+	size_t cells = (length + 15) & ~(size_t) 15;
+	size_t data_size = BFo_precomp_cells?
+		cells + BFo_mem_padding + BFo_precomp_cells : length;
+
+	size_t bss = (cells + BFo_mem_padding + BFi_mem_size + 15)
+		& ~(size_t) 15;
+
+	uint32_t data_addr = DATA_ADDR + HEADERS_SIZE;
+	header_addr = data_addr;
+	cells_addr = data_addr + cells + BFo_mem_padding;
+	inpos_addr = data_addr + bss;
+	inend_addr = inpos_addr + 8;
+	input_addr = inend_addr + 8;
+	output_addr = input_addr + IO_SIZE;
+
+	code_size = STUB_SIZE;
+	for(BFi_instr_t *instr = BFi_code; instr; instr = instr -> next) {
+		code_size += BODY_SIZE;
+
+		switch(instr -> opcode) {
+		case BFI_INSTR_SETB: case BFI_INSTR_ADDB:
+			code_size += instr -> op1 * 8;
+		}
+	}
+
+	code = malloc(code_size);
+	if(!code) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	size_t *subs = calloc(BFo_sub_count + 1, sizeof(size_t));
+	size_t *loops = malloc(sizeof(size_t) * 16);
+	patch_t *patches = malloc(sizeof(patch_t) * 16);
+	if(!(subs && loops && patches)) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	size_t depth = 0, max_depth = 16, count = 0, max_count = 16;
+	pos = 0;
+
+	runtime();
+	size_t entry = pos;
+
+	if(BFo_precomp_output) {
+		emit("\xb8\x01\x00\x00\x00", 5);
+		emit("\x89\xc7", 2);
+		emit("\xbe", 1); emit32(header_addr);
+		emit("\xba", 1); emit32(length);
+		emit("\x0f\x05", 2);
+	}
+
+	if(!BFi_program_str[0]) goto end;
+
+	emit("\xbb", 1); emit32(cells_addr + BFo_precomp_ptr);
+	emit("\x41\xbc", 2); emit32(output_addr);
+
+	bool done_ret = false;
+
+	for(BFi_instr_t *instr = BFi_code; instr; instr = instr -> next) {
+		size_t op1 = instr -> op1, op2 = instr -> op2;
+		ssize_t ad1 = instr -> ad1, ad2 = instr -> ad2;
+		size_t skip, top;
+
+		switch(instr -> opcode) {
+		case BFI_INSTR_INC:
+			emit8(0x80); mem(0, ad1); emit8(op1);
+			break;
+
+		case BFI_INSTR_DEC:
+			emit8(0x80); mem(5, ad1); emit8(op1);
+			break;
+
+		case BFI_INSTR_CMPL:
+			emit8(0xf6); mem(3, ad1);
+			break;
+
+		case BFI_INSTR_MOV:
+			emit8(0xc6); mem(0, ad1); emit8(op1);
+			break;
+
+		case BFI_INSTR_FWD:
+			emit("\x48\x81\xc3", 3); emit32(op1);
+			break;
+
+		case BFI_INSTR_BCK:
+			emit("\x48\x81\xeb", 3); emit32(op1);
+			break;
+
+		case BFI_INSTR_INP:
+			call(getc_pos);
+			emit8(0x72); skip = pos; emit8(0);
+			emit8(0x88); mem(0, ad1);
+			code[skip] = pos - skip - 1;
+			break;
+
+		case BFI_INSTR_OUT:
+			emit8(0x8a); mem(0, ad1);
+			emit("\x41\x88\x04\x24", 4);
+			emit("\x49\xff\xc4", 3);
+			emit("\x49\x81\xfc", 3); emit32(output_addr + IO_SIZE);
+			emit("\x72\x05", 2);
+			call(flush_pos);
+			break;
+
+		case BFI_INSTR_LOOP: case BFI_INSTR_IFNZ:
+			if(depth == max_depth) {
+				max_depth *= 2;
+				loops = realloc(loops, sizeof(size_t) * max_depth);
+				if(!loops) BFe_report_err(BFE_UNKNOWN_ERROR);
+			}
+
+			emit8(0x80); mem(7, ad1); emit8(0);
+			emit("\x0f\x84", 2);
+			loops[depth++] = pos; emit32(0);
+			break;
+
+		case BFI_INSTR_ENDL:
+			top = loops[--depth];
+			emit8(0x80); mem(7, ad1); emit8(0);
+			emit("\x0f\x85", 2); emit32(top + 4 - pos - 4);
+			goto link;
+
+		case BFI_INSTR_ENDIF:
+			top = loops[--depth];
+
+		link:	skip = top;
+			int32_t rel = pos - skip - 4;
+			memcpy(&code[skip], &rel, 4);
+			break;
+
+		case BFI_INSTR_SCAN:
+			if(ad1 != 1 && ad1 != -1) goto scan;
+
+			emit("\x80\x3b\x00", 3);
+			emit8(0x74); size_t exit1 = pos; emit8(0);
+
+			emit("\x48\x89\xda", 3);
+			emit("\x48\x83\xe2\xf0", 4);
+			emit("\x89\xd9", 2);
+			emit("\x83\xe1\x0f", 3);
+			if(ad1 < 0) emit("\x83\xf1\x1f", 3);
+
+			emit("\x66\x0f\xef\xc0", 4);
+			emit("\x66\x0f\x6f\x0a", 4);
+			emit("\x66\x0f\x74\xc8", 4);
+			emit("\x66\x0f\xd7\xc1", 4);
+			emit(ad1 > 0? "\xd3\xe8" : "\xd3\xe0", 2);
+
+			emit("\x85\xc0", 2);
+			emit8(0x74); skip = pos; emit8(0);
+
+			if(ad1 > 0) {
+				emit("\x0f\xbc\xc0", 3);
+				emit("\x48\x01\xc3", 3);
+			}
+
+			else {
+				emit("\x0f\xbd\xc0", 3);
+				emit("\x48\x8d\x5c\x03\xe1", 5);
+			}
+
+			emit8(0xeb); size_t exit2 = pos; emit8(0);
+			code[skip] = pos - skip - 1;
+			top = pos;
+
+			emit(ad1 > 0? "\x48\x83\xc2\x10" : "\x48\x83\xea\x10", 4);
+			emit("\x66\x0f\x6f\x0a", 4);
+			emit("\x66\x0f\x74\xc8", 4);
+			emit("\x66\x0f\xd7\xc1", 4);
+			emit("\x85\xc0", 2);
+			emit8(0x74); emit8(top - pos - 1);
+
+			emit(ad1 > 0? "\x0f\xbc\xc0" : "\x0f\xbd\xc0", 3);
+			emit("\x48\x8d\x1c\x02", 4);
+
+			code[exit1] = pos - exit1 - 1;
+			code[exit2] = pos - exit2 - 1;
+			break;
+
+		scan:	emit(ad1 > 0? "\x48\x81\xeb" : "\x48\x81\xc3", 3);
+			emit32(ad1 > 0? ad1 : -ad1);
+
+			top = pos;
+			emit(ad1 > 0? "\x48\x81\xc3" : "\x48\x81\xeb", 3);
+			emit32(ad1 > 0? ad1 : -ad1);
+
+			emit("\x80\x3b\x00", 3);
+			emit8(0x75); emit8(top - pos - 1);
+			break;
+
+		case BFI_INSTR_MULA: case BFI_INSTR_MULS: case BFI_INSTR_MULM:
+		case BFI_INSTR_SHLA: case BFI_INSTR_SHLS: case BFI_INSTR_SHLM:
+		case BFI_INSTR_CPYA: case BFI_INSTR_CPYS: case BFI_INSTR_CPYM:
+			emit("\x0f\xb6", 2); mem(0, ad2);
+
+			switch(instr -> opcode) {
+			case BFI_INSTR_MULA: case BFI_INSTR_MULS:
+			case BFI_INSTR_MULM:
+				emit("\x69\xc0", 2); emit32(op1);
+				break;
+
+			case BFI_INSTR_SHLA: case BFI_INSTR_SHLS:
+			case BFI_INSTR_SHLM:
+				emit("\xc1\xe0", 2); emit8(op2);
+			}
+
+			switch(instr -> opcode) {
+			case BFI_INSTR_MULA: case BFI_INSTR_SHLA:
+			case BFI_INSTR_CPYA:
+				emit8(0x00);
+				break;
+
+			case BFI_INSTR_MULS: case BFI_INSTR_SHLS:
+			case BFI_INSTR_CPYS:
+				emit8(0x28);
+				break;
+
+			default:
+				emit8(0x88);
+			}
+
+			mem(0, ad1);
+			break;
+
+		case BFI_INSTR_PRDA:
+			emit("\x0f\xb6", 2); mem(0, ad2);
+			emit("\x0f\xb6", 2); mem(1, (ssize_t) op2);
+			emit("\x0f\xaf\xc1", 3);
+			emit("\x69\xc0", 2); emit32(op1);
+			emit8(0x00); mem(0, ad1);
+			break;
+
+		case BFI_INSTR_SETB: case BFI_INSTR_ADDB:
+			block(instr);
+			break;
+
+		case BFI_INSTR_SUB:
+			subs[op1] = pos;
+			break;
+
+		case BFI_INSTR_JSR:
+			if(count == max_count) {
+				max_count *= 2;
+				patches = realloc(patches,
+					sizeof(patch_t) * max_count);
+
+				if(!patches) BFe_report_err(BFE_UNKNOWN_ERROR);
+			}
+
+			emit8(0xe8);
+			patches[count].pos = pos;
+			patches[count++].target = op1;
+			emit32(0);
+			break;
+
+		case BFI_INSTR_RTS:
+			emit8(0xc3);
+			break;
+
+		case BFI_INSTR_RET:
+			call(flush_pos);
+			finish();
+			done_ret = true;
+		}
+	}
+
+	for(size_t i = 0; i < count; i++) {
+		int32_t rel = subs[patches[i].target] - patches[i].pos - 4;
+		memcpy(&code[patches[i].pos], &rel, 4);
+	}
+
+	if(done_ret) goto write;
+	call(flush_pos);
+
+end:	finish();
+
+write:	free(subs);
+	free(loops);
+	free(patches);
+
+	size_t text = HEADERS_SIZE + data_size;
+
+	Elf64_Ehdr ehdr = {
+		.e_ident = {
+			ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3,
+			ELFCLASS64, ELFDATA2LSB, EV_CURRENT, ELFOSABI_SYSV
+		},
+
+		.e_type = ET_EXEC,
+		.e_machine = EM_X86_64,
+		.e_version = EV_CURRENT,
+		.e_entry = TEXT_ADDR + text + entry,
+		.e_phoff = sizeof(Elf64_Ehdr),
+		.e_ehsize = sizeof(Elf64_Ehdr),
+		.e_phentsize = sizeof(Elf64_Phdr),
+		.e_phnum = 3
+	};
+
+	Elf64_Phdr phdrs[3] = {{
+		.p_type = PT_LOAD,
+		.p_flags = PF_R | PF_X,
+		.p_offset = 0,
+		.p_vaddr = TEXT_ADDR,
+		.p_paddr = TEXT_ADDR,
+		.p_filesz = text + pos,
+		.p_memsz = text + pos,
+		.p_align = PAGE_SIZE
+	}, {
+		.p_type = PT_LOAD,
+		.p_flags = PF_R | PF_W,
+		.p_offset = HEADERS_SIZE,
+		.p_vaddr = data_addr,
+		.p_paddr = data_addr,
+		.p_filesz = data_size,
+		.p_memsz = output_addr + IO_SIZE - data_addr,
+		.p_align = PAGE_SIZE
+	}, {
+		.p_type = PT_GNU_STACK,
+		.p_flags = PF_R | PF_W,
+		.p_align = 16
+	}};
+
+	fwrite(&ehdr, sizeof(ehdr), 1, file);
+	fwrite(phdrs, sizeof(phdrs), 1, file);
+
+	if(length) fwrite(BFo_precomp_output, 1, length, file);
+	for(size_t i = length; i < data_size; i++) {
+		size_t cell = i - cells - BFo_mem_padding;
+		fputc(i < cells + BFo_mem_padding? 0 : BFi_mem[cell], file);
+	}
+
+	fwrite(code, 1, pos, file);
+	free(code);
+	code = NULL;
+
+	struct stat st;
+	if(file != stdout && !fstat(fileno(file), &st))
+		fchmod(fileno(file), st.st_mode | (st.st_mode & 0444) >> 2);
+}
+
+/* Output is collected in a buffer that is written out when it fills up,
+ * before every read and at exit. getc sets the carry flag at the end of the
+ * input so that the cell is left unchanged. */
+
+static void runtime() {
+	size_t top, skip1, skip2;
+
+	flush_pos = pos;
+	emit("\xbe", 1); emit32(output_addr);
+	top = pos;
+	emit("\x4c\x89\xe2", 3);
+	emit("\x48\x29\xf2", 3);
+	emit8(0x76); skip1 = pos; emit8(0);
+	emit("\xb8\x01\x00\x00\x00", 5);
+	emit("\x89\xc7", 2);
+	emit("\x0f\x05", 2);
+	emit("\x48\x85\xc0", 3);
+	emit8(0x7e); skip2 = pos; emit8(0);
+	emit("\x48\x01\xc6", 3);
+	emit8(0xeb); emit8(top - pos - 1);
+	code[skip1] = pos - skip1 - 1;
+	code[skip2] = pos - skip2 - 1;
+	emit("\x41\xbc", 2); emit32(output_addr);
+	emit8(0xc3);
+
+	getc_pos = pos;
+	emit("\x48\x8b\x34\x25", 4); emit32(inpos_addr);
+	emit("\x48\x3b\x34\x25", 4); emit32(inend_addr);
+	emit8(0x72); skip1 = pos; emit8(0);
+	call(flush_pos);
+	emit("\x31\xc0", 2);
+	emit("\x31\xff", 2);
+	emit("\xbe", 1); emit32(input_addr);
+	emit("\xba", 1); emit32(IO_SIZE);
+	emit("\x0f\x05", 2);
+	emit("\x48\x85\xc0", 3);
+	emit8(0x7e); skip2 = pos; emit8(0);
+	emit("\x48\x01\xf0", 3);
+	emit("\x48\x89\x04\x25", 4); emit32(inend_addr);
+	code[skip1] = pos - skip1 - 1;
+	emit("\x8a\x06", 2);
+	emit("\x48\xff\xc6", 3);
+	emit("\x48\x89\x34\x25", 4); emit32(inpos_addr);
+	emit("\xf8\xc3", 2);
+	code[skip2] = pos - skip2 - 1;
+	emit("\xf9\xc3", 2);
+}
+
+/* Blocks are built up eight bytes at a time in rax, going through xmm
+ * registers for adds, and finished off one byte at a time. */
+
+static void block(BFi_instr_t *instr) {
+	size_t i = 0, len = instr -> op1;
+	unsigned char *values = &BFo_blocks[instr -> op2];
+
+	for(; len - i >= 8; i += 8) {
+		ssize_t ad = instr -> ad1 + i;
+
+		emit("\x48\xb8", 2); emit((char *) &values[i], 8);
+
+		if(instr -> opcode == BFI_INSTR_SETB) {
+			emit("\x48\x89", 2); mem(0, ad);
+			continue;
+		}
+
+		emit("\x66\x48\x0f\x6e\xc8", 5);
+		emit("\xf3\x0f\x7e", 3); mem(0, ad);
+		emit("\x66\x0f\xfc\xc1", 4);
+		emit("\x66\x0f\xd6", 3); mem(0, ad);
+	}
+
+	for(; i < len; i++) {
+		if(instr -> opcode == BFI_INSTR_SETB) emit8(0xc6);
+		else if(values[i]) emit8(0x80);
+		else continue;
+
+		mem(0, instr -> ad1 + i); emit8(values[i]);
+	}
+}
+
+static void finish() {
+	emit("\xb8\x3c\x00\x00\x00", 5);
+	emit("\x31\xff", 2);
+	emit("\x0f\x05", 2);
+}
+
+static void emit(const char *bytes, size_t len) {
+	memcpy(&code[pos], bytes, len);
+	pos += len;
+}
+
+static void emit8(unsigned char byte) {
+	code[pos++] = byte;
+}
+
+static void emit32(int32_t num) {
+	memcpy(&code[pos], &num, 4);
+	pos += 4;
+}
+
+static void call(size_t target) {
+	emit8(0xe8);
+	emit32(target - pos - 4);
+}
+
+static void mem(int reg, ssize_t ad) {
+	if(!ad) emit8(0x03 | reg << 3);
+
+	else if(ad >= -128 && ad < 128) {
+		emit8(0x43 | reg << 3);
+		emit8(ad);
+	}
+
+	else {
+		emit8(0x83 | reg << 3);
+		emit32(ad);
+	}
+}
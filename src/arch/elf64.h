@@ -0,0 +1,22 @@
+/* Bfcli: The Interactive Brainfuck Command-Line Interpreter
+ * Copyright (C) 2021-2022 Jyothiraditya Nellakra
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>. */
+
+#ifndef BF_ARCH_ELF64_H
+#define BF_ARCH_ELF64_H 1
+
+extern void BFa_elf64_t(FILE *file);
+
+#endif
\ No newline at end of file
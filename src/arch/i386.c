@@ -29,6 +29,13 @@
 #include "../optims.h"
 #include "../translator.h"
 
+#define IO_SIZE 65536
+
+static bool innermost(BFi_instr_t *instr);
+static void tasm_block(FILE *file, BFi_instr_t *instr);
+static void tasm_runtime(FILE *file);
+static void tc_block(FILE *file, BFi_instr_t *instr);
+
 void BFa_i386_tasm(FILE *file) {
 	if(BFo_precomp_output) {
 		fprintf(file, "\t.data\n");
@@ -87,9 +94,8 @@ n2:	fprintf(file, "\t.text\n");
 	
 	if(!BFo_precomp_ptr) fprintf(file, "\tmov\t$cells, %%esi\n");
 	else fprintf(file, "\tmov\t$(cells + %zu), %%esi\n", BFo_precomp_ptr);
+	fprintf(file, "\tmov\t$output, %%edi\n");
 
-	int last_io_instr = BFI_INSTR_NOP;
-	bool regs_dirty = true;
 	bool done_ret = false;
 
 	for(BFi_instr_t *instr = BFi_code; instr; instr = instr -> next) {
@@ -118,55 +124,50 @@ n2:	fprintf(file, "\t.text\n");
 			break;
 
 		case BFI_INSTR_INP:
-			if(ad1) fprintf(file, "\tlea\t%zd", ad1);
-			else fprintf(file, "\tlea\t");
-			fprintf(file, "(%%esi), %%ecx\n");
-
-			if(last_io_instr == BFI_INSTR_INP)
-				if(!regs_dirty) goto in;
-
-			fprintf(file, "\tmov\t$0, %%ebx\n");
-			fprintf(file, "\tmov\t$1, %%edx\n");
-		in:	fprintf(file, "\tmov\t$3, %%eax\n");
-			fprintf(file, "\tint\t$0x80\n");
-
-			last_io_instr = BFI_INSTR_INP;
-			regs_dirty = false;
+			fprintf(file, "\tcall\tgetc\n");
+			fprintf(file, "\tjc\t1f\n");
+			fprintf(file, "\tmovb\t%%al, ");
+			if(ad1) fprintf(file, "%zd(%%esi)\n", ad1);
+			else fprintf(file, "(%%esi)\n");
+			fprintf(file, "1:\n");
 			break;
 
 		case BFI_INSTR_OUT:
-			if(ad1) fprintf(file, "\tlea\t%zd", ad1);
-			else fprintf(file, "\tlea\t");
-			fprintf(file, "(%%esi), %%ecx\n");
-
-			if(last_io_instr == BFI_INSTR_OUT)
-				if(!regs_dirty) goto out;
-
-			fprintf(file, "\tmov\t$1, %%ebx\n");
-			fprintf(file, "\tmov\t%%ebx, %%edx\n");
-		out:	fprintf(file, "\tmov\t$4, %%eax\n");
-			fprintf(file, "\tint\t$0x80\n");
+			fprintf(file, "\tmovb\t");
+			if(ad1) fprintf(file, "%zd(%%esi), %%al\n", ad1);
+			else fprintf(file, "(%%esi), %%al\n");
 
-			last_io_instr = BFI_INSTR_OUT;
-			regs_dirty = false;
+			fprintf(file, "\tmovb\t%%al, (%%edi)\n");
+			fprintf(file, "\tinc\t%%edi\n");
+			fprintf(file, "\tcmp\t$(output + %d), %%edi\n", IO_SIZE);
+			fprintf(file, "\tjb\t1f\n");
+			fprintf(file, "\tcall\tflush\n");
+			fprintf(file, "1:\n");
 			break;
 
 		case BFI_INSTR_LOOP:
-			fprintf(file, "\n.L%zu:\n", op1);
-			fprintf(file, "\tcmpb\t$0, (%%esi)\n");
-			fprintf(file, "\tje\t.LE%zu\n", op1);
-			regs_dirty = true;
+			fprintf(file, "\tcmpb\t$0, ");
+			if(ad1) fprintf(file, "%zd(%%esi)\n", ad1);
+			else fprintf(file, "(%%esi)\n");
+			fprintf(file, "\tje\t.LE%zu\n\n", op1);
+
+			if(innermost(instr)) fprintf(file, "\t.p2align\t4,,10\n");
+			fprintf(file, ".L%zu:\n", op1);
 			break;
 
 		case BFI_INSTR_ENDL:
-			fprintf(file, "\tjmp\t.L%zu\n", op1);
+			fprintf(file, "\tcmpb\t$0, ");
+			if(ad1) fprintf(file, "%zd(%%esi)\n", ad1);
+			else fprintf(file, "(%%esi)\n");
+			fprintf(file, "\tjne\t.L%zu\n", op1);
 			fprintf(file, "\n.LE%zu:\n", op1);
-			regs_dirty = true;
 			break;
 
 		case BFI_INSTR_IFNZ:
 			fprintf(file, "\n.L%zu:\n", op1);
-			fprintf(file, "\tcmpb\t$0, (%%esi)\n");
+			fprintf(file, "\tcmpb\t$0, ");
+			if(ad1) fprintf(file, "%zd(%%esi)\n", ad1);
+			else fprintf(file, "(%%esi)\n");
 			fprintf(file, "\tje\t.LE%zu\n", op1);
 			break;
 
@@ -175,7 +176,9 @@ n2:	fprintf(file, "\t.text\n");
 			break;
 
 		case BFI_INSTR_CMPL:
-			fprintf(file, "\tnegb\t(%%esi)\n");
+			fprintf(file, "\tnegb\t");
+			if(ad1) fprintf(file, "%zd(%%esi)\n", ad1);
+			else fprintf(file, "(%%esi)\n");
 			break;
 
 		case BFI_INSTR_MOV:
@@ -184,6 +187,18 @@ n2:	fprintf(file, "\t.text\n");
 			else fprintf(file, "(%%esi)\n");
 			break;
 
+		case BFI_INSTR_SCAN:
+			if(ad1 > 0) fprintf(file, "\tsub\t$%zd, %%esi\n", ad1);
+			else fprintf(file, "\tadd\t$%zd, %%esi\n", -ad1);
+
+			fprintf(file, "\n.L%zu:\n", op1);
+			if(ad1 > 0) fprintf(file, "\tadd\t$%zd, %%esi\n", ad1);
+			else fprintf(file, "\tsub\t$%zd, %%esi\n", -ad1);
+
+			fprintf(file, "\tcmpb\t$0, (%%esi)\n");
+			fprintf(file, "\tjne\t.L%zu\n", op1);
+			break;
+
 		case BFI_INSTR_MULA:
 			if(instr -> prev -> opcode == BFI_INSTR_MULA
 				&& instr -> prev -> op1 == op1
@@ -200,7 +215,6 @@ n2:	fprintf(file, "\t.text\n");
 		mula:	fprintf(file, "\taddb\t%%al, ");
 			if(ad1) fprintf(file, "%zd(%%esi)\n", ad1);
 			else fprintf(file, "(%%esi)\n");
-			regs_dirty = true;
 			break;
 
 		lmula:	if(ad2) fprintf(file, "\tmovzb\t%zd(%%esi), ", ad2);
@@ -227,7 +241,6 @@ n2:	fprintf(file, "\t.text\n");
 		muls:	fprintf(file, "\tsubb\t%%al, ");
 			if(ad1) fprintf(file, "%zd(%%esi)\n", ad1);
 			else fprintf(file, "(%%esi)\n");
-			regs_dirty = true;
 			break;
 
 		lmuls:	if(ad2) fprintf(file, "\tmovzb\t%zd(%%esi), ", ad2);
@@ -255,7 +268,6 @@ n2:	fprintf(file, "\t.text\n");
 		mulm:	fprintf(file, "\tmovb\t%%al, ");
 			if(ad1) fprintf(file, "%zd(%%esi)\n", ad1);
 			else fprintf(file, "(%%esi)\n");
-			regs_dirty = true;
 			break;
 
 		lmulm:	if(ad2) fprintf(file, "\tmovzb\t%zd(%%esi), ", ad2);
@@ -376,22 +388,37 @@ n2:	fprintf(file, "\t.text\n");
 			fprintf(file, "%%al\n");
 			goto mulm;
 
+		case BFI_INSTR_PRDA:
+			if(ad2) fprintf(file, "\tmovzb\t%zd(%%esi), ", ad2);
+			else fprintf(file, "\tmovzb\t(%%esi), ");
+			fprintf(file, "%%eax\n");
+
+			if(op2) fprintf(file, "\tmovzb\t%zd(%%esi), ", (ssize_t) op2);
+			else fprintf(file, "\tmovzb\t(%%esi), ");
+			fprintf(file, "%%ecx\n");
+
+			fprintf(file, "\timul\t%%ecx, %%eax\n");
+			if(op1 != 1) fprintf(file, "\timul\t$%zu, %%eax\n", op1);
+			goto mula;
+
+		case BFI_INSTR_SETB: case BFI_INSTR_ADDB:
+			tasm_block(file, instr);
+			break;
+
 		case BFI_INSTR_SUB:
 			fprintf(file, "\n_%zu:\n", op1);
-			regs_dirty = true;
 			break;
 
 		case BFI_INSTR_JSR:
 			fprintf(file, "\tcall\t_%zu\n", op1);
-			regs_dirty = true;
 			break;
 
 		case BFI_INSTR_RTS:
 			fprintf(file, "\tret\n");
-			regs_dirty = true;
 			break;
 
 		case BFI_INSTR_RET:
+			fprintf(file, "\tcall\tflush\n");
 			fprintf(file, "\tmov\t$1, %%eax\n");
 			fprintf(file, "\tmov\t$0, %%ebx\n");
 			fprintf(file, "\tint\t$0x80\n");
@@ -399,12 +426,120 @@ n2:	fprintf(file, "\t.text\n");
 		}
 	}
 
-	if(done_ret) return;
+	if(done_ret) goto runtime;
+
+	fprintf(file, "\tcall\tflush\n");
+	fprintf(file, "\tmov\t$1, %%eax\n");
+	fprintf(file, "\tmov\t$0, %%ebx\n");
+	fprintf(file, "\tint\t$0x80\n");
+
+runtime:	tasm_runtime(file);
+	return;
+
 end:	fprintf(file, "\tmov\t$1, %%eax\n");
 	fprintf(file, "\tmov\t$0, %%ebx\n");
 	fprintf(file, "\tint\t$0x80\n");
 }
 
+/* Output is collected in a buffer that is written out when it fills up,
+ * before every read and at exit. Input is read in blocks of the same size,
+ * and getc sets the carry flag at the end of the input so that the cell is
+ * left unchanged, as with a single-byte read. */
+
+/* Loops are rotated so that each iteration only tests the cell at the bottom,
+ * and the heads of loops without any nested loops or calls are aligned. */
+
+static bool innermost(BFi_instr_t *instr) {
+	for(instr = instr -> next; instr; instr = instr -> next) {
+		switch(instr -> opcode) {
+		case BFI_INSTR_LOOP: case BFI_INSTR_JSR:
+			return false;
+
+		case BFI_INSTR_ENDL:
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Without SSE to fall back on, blocks are stored four bytes at a time and
+ * added to one byte at a time. */
+
+static void tasm_block(FILE *file, BFi_instr_t *instr) {
+	size_t i = 0, len = instr -> op1, off = instr -> op2;
+
+	for(; instr -> opcode == BFI_INSTR_SETB && len - i >= 4; i += 4) {
+		unsigned long value = 0;
+		ssize_t ad = instr -> ad1 + i;
+
+		for(int j = 3; j >= 0; j--)
+			value = value << 8 | BFo_blocks[off + i + j];
+
+		fprintf(file, "\tmovl\t$%lu, ", value);
+		if(ad) fprintf(file, "%zd(%%esi)\n", ad);
+		else fprintf(file, "(%%esi)\n");
+	}
+
+	for(; i < len; i++) {
+		unsigned char value = BFo_blocks[off + i];
+		ssize_t ad = instr -> ad1 + i;
+
+		if(instr -> opcode == BFI_INSTR_SETB)
+			fprintf(file, "\tmovb\t$%d, ", value);
+		else if(value) fprintf(file, "\taddb\t$%d, ", value);
+		else continue;
+
+		if(ad) fprintf(file, "%zd(%%esi)\n", ad);
+		else fprintf(file, "(%%esi)\n");
+	}
+}
+
+static void tasm_runtime(FILE *file) {
+	fprintf(file, "\nflush:\n");
+	fprintf(file, "\tmov\t$output, %%ecx\n");
+	fprintf(file, "1:\tmov\t%%edi, %%edx\n");
+	fprintf(file, "\tsub\t%%ecx, %%edx\n");
+	fprintf(file, "\tjbe\t2f\n");
+	fprintf(file, "\tmov\t$4, %%eax\n");
+	fprintf(file, "\tmov\t$1, %%ebx\n");
+	fprintf(file, "\tint\t$0x80\n");
+	fprintf(file, "\ttest\t%%eax, %%eax\n");
+	fprintf(file, "\tjle\t2f\n");
+	fprintf(file, "\tadd\t%%eax, %%ecx\n");
+	fprintf(file, "\tjmp\t1b\n");
+	fprintf(file, "2:\tmov\t$output, %%edi\n");
+	fprintf(file, "\tret\n");
+
+	fprintf(file, "\ngetc:\n");
+	fprintf(file, "\tmov\tinpos, %%ecx\n");
+	fprintf(file, "\tcmp\tinend, %%ecx\n");
+	fprintf(file, "\tjb\t1f\n");
+	fprintf(file, "\tcall\tflush\n");
+	fprintf(file, "\tmov\t$3, %%eax\n");
+	fprintf(file, "\tmov\t$0, %%ebx\n");
+	fprintf(file, "\tmov\t$input, %%ecx\n");
+	fprintf(file, "\tmov\t$%d, %%edx\n", IO_SIZE);
+	fprintf(file, "\tint\t$0x80\n");
+	fprintf(file, "\ttest\t%%eax, %%eax\n");
+	fprintf(file, "\tjle\t2f\n");
+	fprintf(file, "\tadd\t%%ecx, %%eax\n");
+	fprintf(file, "\tmov\t%%eax, inend\n");
+	fprintf(file, "1:\tmovb\t(%%ecx), %%al\n");
+	fprintf(file, "\tinc\t%%ecx\n");
+	fprintf(file, "\tmov\t%%ecx, inpos\n");
+	fprintf(file, "\tclc\n");
+	fprintf(file, "\tret\n");
+	fprintf(file, "2:\tstc\n");
+	fprintf(file, "\tret\n");
+
+	fprintf(file, "\n\t.bss\n");
+	fprintf(file, "inpos:\t.skip\t4\n");
+	fprintf(file, "inend:\t.skip\t4\n");
+	fprintf(file, "input:\t.skip\t%d\n", IO_SIZE);
+	fprintf(file, "output:\t.skip\t%d\n", IO_SIZE);
+}
+
 void BFa_i386_tc(FILE *file) {
 	fprintf(file, "\tasm volatile (\n");
 	fprintf(file, "\t\"\tmov\t%%0, %%%%esi\\n\"\n");
@@ -472,21 +607,32 @@ void BFa_i386_tc(FILE *file) {
 			break;
 
 		case BFI_INSTR_LOOP:
-			fprintf(file, "\n\t\".L%zu:\\n\"\n", op1);
-			fprintf(file, "\t\"\tcmpb\t$0, (%%%%esi)\\n\"\n");
+			fprintf(file, "\t\"\tcmpb\t$0, ");
+			if(ad1) fprintf(file, "%zd(%%%%esi)\\n\"\n", ad1);
+			else fprintf(file, "(%%%%esi)\\n\"\n");
 			fprintf(file, "\t\"\tje\t.LE%zu\\n\"\n", op1);
+
+			if(innermost(instr))
+				fprintf(file, "\t\"\t.p2align\t4,,10\\n\"\n");
+
+			fprintf(file, "\n\t\".L%zu:\\n\"\n", op1);
 			regs_dirty = true;
 			break;
 
 		case BFI_INSTR_ENDL:
-			fprintf(file, "\t\"\tjmp\t.L%zu\\n\"\n", op1);
+			fprintf(file, "\t\"\tcmpb\t$0, ");
+			if(ad1) fprintf(file, "%zd(%%%%esi)\\n\"\n", ad1);
+			else fprintf(file, "(%%%%esi)\\n\"\n");
+			fprintf(file, "\t\"\tjne\t.L%zu\\n\"\n", op1);
 			fprintf(file, "\n\t\".LE%zu:\\n\"\n", op1);
 			regs_dirty = true;
 			break;
 
 		case BFI_INSTR_IFNZ:
 			fprintf(file, "\n\t\".L%zu:\\n\"\n", op1);
-			fprintf(file, "\t\"\tcmpb\t$0, (%%%%esi)\\n\"\n");
+			fprintf(file, "\t\"\tcmpb\t$0, ");
+			if(ad1) fprintf(file, "%zd(%%%%esi)\\n\"\n", ad1);
+			else fprintf(file, "(%%%%esi)\\n\"\n");
 			fprintf(file, "\t\"\tje\t.LE%zu\\n\"\n", op1);
 			break;
 
@@ -495,7 +641,9 @@ void BFa_i386_tc(FILE *file) {
 			break;
 
 		case BFI_INSTR_CMPL:
-			fprintf(file, "\t\"\tnegb\t(%%%%esi)\\n\"\n");
+			fprintf(file, "\t\"\tnegb\t");
+			if(ad1) fprintf(file, "%zd(%%%%esi)\\n\"\n", ad1);
+			else fprintf(file, "(%%%%esi)\\n\"\n");
 			break;
 
 		case BFI_INSTR_MOV:
@@ -504,6 +652,20 @@ void BFa_i386_tc(FILE *file) {
 			else fprintf(file, "(%%%%esi)\\n\"\n");
 			break;
 
+		case BFI_INSTR_SCAN:
+			if(ad1 > 0) fprintf(file,
+				"\t\"\tsub\t$%zd, %%%%esi\\n\"\n", ad1);
+			else fprintf(file, "\t\"\tadd\t$%zd, %%%%esi\\n\"\n", -ad1);
+
+			fprintf(file, "\n\t\".L%zu:\\n\"\n", op1);
+			if(ad1 > 0) fprintf(file,
+				"\t\"\tadd\t$%zd, %%%%esi\\n\"\n", ad1);
+			else fprintf(file, "\t\"\tsub\t$%zd, %%%%esi\\n\"\n", -ad1);
+
+			fprintf(file, "\t\"\tcmpb\t$0, (%%%%esi)\\n\"\n");
+			fprintf(file, "\t\"\tjne\t.L%zu\\n\"\n", op1);
+			break;
+
 		case BFI_INSTR_MULA:
 			if(instr -> prev -> opcode == BFI_INSTR_MULA
 				&& instr -> prev -> op1 == op1
@@ -696,6 +858,25 @@ void BFa_i386_tc(FILE *file) {
 			fprintf(file, "%%%%al\\n\"\n");
 			goto mulm;
 
+		case BFI_INSTR_PRDA:
+			if(ad2) fprintf(file, "\t\"\tmovzb\t%zd(%%%%esi), ", ad2);
+			else fprintf(file, "\t\"\tmovzb\t(%%%%esi), ");
+			fprintf(file, "%%%%eax\\n\"\n");
+
+			if(op2) fprintf(file, "\t\"\tmovzb\t%zd(%%%%esi), ",
+				(ssize_t) op2);
+			else fprintf(file, "\t\"\tmovzb\t(%%%%esi), ");
+			fprintf(file, "%%%%ecx\\n\"\n");
+
+			fprintf(file, "\t\"\timul\t%%%%ecx, %%%%eax\\n\"\n");
+			if(op1 != 1) fprintf(file,
+				"\t\"\timul\t$%zu, %%%%eax\\n\"\n", op1);
+			goto mula;
+
+		case BFI_INSTR_SETB: case BFI_INSTR_ADDB:
+			tc_block(file, instr);
+			break;
+
 		case BFI_INSTR_SUB:
 			fprintf(file, "\n\t\"_%zu:\\n\"\n", op1);
 			regs_dirty = true;
@@ -724,4 +905,32 @@ void BFa_i386_tc(FILE *file) {
 	fprintf(file, "\t:\t\"eax\", \"ebx\", \"ecx\", \"edx\", \"esi\"\n\t);\n\n");
 
 	fprintf(file, "\treturn 0;\n");
-}
\ No newline at end of file
+}
+static void tc_block(FILE *file, BFi_instr_t *instr) {
+	size_t i = 0, len = instr -> op1, off = instr -> op2;
+
+	for(; instr -> opcode == BFI_INSTR_SETB && len - i >= 4; i += 4) {
+		unsigned long value = 0;
+		ssize_t ad = instr -> ad1 + i;
+
+		for(int j = 3; j >= 0; j--)
+			value = value << 8 | BFo_blocks[off + i + j];
+
+		fprintf(file, "\t\"\tmovl\t$%lu, ", value);
+		if(ad) fprintf(file, "%zd(%%%%esi)\\n\"\n", ad);
+		else fprintf(file, "(%%%%esi)\\n\"\n");
+	}
+
+	for(; i < len; i++) {
+		unsigned char value = BFo_blocks[off + i];
+		ssize_t ad = instr -> ad1 + i;
+
+		if(instr -> opcode == BFI_INSTR_SETB)
+			fprintf(file, "\t\"\tmovb\t$%d, ", value);
+		else if(value) fprintf(file, "\t\"\taddb\t$%d, ", value);
+		else continue;
+
+		if(ad) fprintf(file, "%zd(%%%%esi)\\n\"\n", ad);
+		else fprintf(file, "(%%%%esi)\\n\"\n");
+	}
+}
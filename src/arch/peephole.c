@@ -0,0 +1,509 @@
+/* Bfcli: The Interactive Brainfuck Command-Line Interpreter
+ * Copyright (C) 2021-2022 Jyothiraditya Nellakra
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>. */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "peephole.h"
+
+#include "../errors.h"
+
+/* The x86 emitters write their output into memory, where it is split into
+ * lines and cleaned up before being written to the real file:
+ *
+ *   - immediate adds and subs to the same operand are folded together,
+ *   - jumps to a label that only jumps again are sent straight on,
+ *   - jumps to the very next label and unused local labels are dropped,
+ *   - a compare with zero right after arithmetic on the same byte is dropped
+ *     when only the zero flag is tested.
+ *
+ * Lines that are not understood are left alone and stop any folding. */
+
+#define MAX_HOPS 16
+
+typedef enum {
+	LINE_BLANK, LINE_LABEL, LINE_INSTR, LINE_OTHER
+} kind_t;
+
+typedef struct {
+	kind_t kind;
+	char *text;
+	char *mnem;
+	char *args;
+
+	bool owned;
+	bool dead;
+} line_t;
+
+typedef struct {
+	const char *name;
+	size_t index;
+
+	bool unique;
+	bool used;
+} label_t;
+
+static line_t *lines;
+static size_t line_count;
+
+static label_t *labels;
+static size_t label_count;
+
+static bool nasm_syntax;
+static size_t removed;
+
+static void parse(char *buf, size_t size);
+static void index_labels();
+static int compare_labels(const void *a, const void *b);
+static label_t *find_label(const char *name);
+
+static size_t next_line(size_t i);
+static size_t prev_line(size_t i);
+static void kill(size_t i);
+
+static bool immediate(line_t *line, const char **dest, size_t *len,
+	long *value, bool *byte);
+static bool conditional(size_t i);
+static bool zero_test(size_t i);
+static const char *operand(const char *str, size_t *len);
+
+static void fold();
+static void thread();
+static void prune();
+static void reuse_flags();
+
+void BFa_peephole(FILE *file, void (*emit)(FILE *file), bool nasm) {
+	char *buf = NULL;
+	size_t size = 0;
+
+	FILE *mem = open_memstream(&buf, &size);
+	if(!mem) { emit(file); return; }
+
+	emit(mem);
+	fclose(mem);
+
+	nasm_syntax = nasm;
+	removed = 0;
+
+	parse(buf, size);
+	fold();
+	thread();
+	prune();
+	reuse_flags();
+
+	for(size_t i = 0; i < line_count; i++) {
+		line_t *line = &lines[i];
+		if(line -> dead) continue;
+
+		switch(line -> kind) {
+		case LINE_BLANK:
+			fprintf(file, "\n");
+			break;
+
+		case LINE_LABEL:
+			fprintf(file, "%s:\n", line -> text);
+			break;
+
+		case LINE_INSTR:
+			if(line -> args) fprintf(file, "\t%s\t%s\n",
+				line -> mnem, line -> args);
+
+			else fprintf(file, "\t%s\n", line -> mnem);
+			break;
+
+		case LINE_OTHER:
+			fprintf(file, "%s\n", line -> text);
+		}
+
+		if(line -> owned) free(line -> mnem);
+	}
+
+	fprintf(file, "\n%s peephole: %zu instructions removed\n",
+		nasm? ";": "#", removed);
+
+	free(lines);
+	free(labels);
+	free(buf);
+}
+
+static void parse(char *buf, size_t size) {
+	line_count = 1;
+	for(size_t i = 0; i < size; i++) if(buf[i] == '\n') line_count++;
+
+	lines = malloc(sizeof(line_t) * line_count);
+	if(!lines) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	line_count = 0;
+
+	for(char *text = buf; text < buf + size;) {
+		char *end = memchr(text, '\n', buf + size - text);
+		if(end) *end = 0; else end = buf + size;
+
+		line_t *line = &lines[line_count++];
+		*line = (line_t) {LINE_OTHER, text, NULL, NULL, false, false};
+
+		size_t len = end - text;
+		text = end + 1;
+
+		if(!len) line -> kind = LINE_BLANK;
+
+		else if(line -> text[0] == '\t') {
+			if(line -> text[1] == '.') continue;
+
+			line -> kind = LINE_INSTR;
+			line -> mnem = line -> text + 1;
+
+			char *tab = strchr(line -> mnem, '\t');
+			if(tab) { *tab = 0; line -> args = tab + 1; }
+		}
+
+		else if(line -> text[len - 1] == ':'
+			&& !strpbrk(line -> text, " \t"))
+		{
+			line -> kind = LINE_LABEL;
+			line -> text[len - 1] = 0;
+		}
+	}
+}
+
+static void index_labels() {
+	label_count = 0;
+	for(size_t i = 0; i < line_count; i++)
+		if(lines[i].kind == LINE_LABEL) label_count++;
+
+	labels = malloc(sizeof(label_t) * (label_count + 1));
+	if(!labels) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	label_count = 0;
+
+	for(size_t i = 0; i < line_count; i++) {
+		if(lines[i].kind != LINE_LABEL) continue;
+
+		labels[label_count++] = (label_t) {
+			lines[i].text, i, true, false
+		};
+	}
+
+	qsort(labels, label_count, sizeof(label_t), compare_labels);
+
+	for(size_t i = 1; i < label_count; i++) {
+		if(strcmp(labels[i - 1].name, labels[i].name)) continue;
+		labels[i - 1].unique = labels[i].unique = false;
+	}
+}
+
+static int compare_labels(const void *a, const void *b) {
+	return strcmp(((label_t *) a) -> name, ((label_t *) b) -> name);
+}
+
+static label_t *find_label(const char *name) {
+	label_t key = {name, 0, false, false};
+	return bsearch(&key, labels, label_count, sizeof(label_t),
+		compare_labels);
+}
+
+static size_t next_line(size_t i) {
+	for(i++; i < line_count; i++)
+		if(!lines[i].dead && lines[i].kind != LINE_BLANK) break;
+
+	return i;
+}
+
+static size_t prev_line(size_t i) {
+	while(i--) if(!lines[i].dead && lines[i].kind != LINE_BLANK) return i;
+	return line_count;
+}
+
+static void kill(size_t i) {
+	lines[i].dead = true;
+	if(lines[i].kind == LINE_INSTR) removed++;
+}
+
+static bool immediate(line_t *line, const char **dest, size_t *len,
+	long *value, bool *byte)
+{
+	if(line -> kind != LINE_INSTR || !line -> args) return false;
+
+	const char *mnem = line -> mnem, *suffix = mnem + 3;
+	long sign;
+
+	if(!strncmp(mnem, "add", 3) || !strncmp(mnem, "inc", 3)) sign = 1;
+	else if(!strncmp(mnem, "sub", 3) || !strncmp(mnem, "dec", 3)) sign = -1;
+	else return false;
+
+	if(nasm_syntax && *suffix) return false;
+	if(*suffix && (suffix[1] || !strchr("bwlq", *suffix))) return false;
+
+	char *end;
+
+	if(mnem[0] == 'i' || mnem[0] == 'd') {
+		*dest = line -> args;
+		*len = strlen(*dest);
+		*value = sign;
+	}
+
+	else if(nasm_syntax) {
+		const char *comma = strrchr(line -> args, ',');
+		if(!comma || comma[1] != ' ' || !comma[2]) return false;
+
+		*value = sign * strtol(comma + 2, &end, 10);
+		if(*end) return false;
+
+		*dest = line -> args;
+		*len = comma - line -> args;
+	}
+
+	else {
+		if(line -> args[0] != '$') return false;
+
+		*value = sign * strtol(line -> args + 1, &end, 10);
+		if(end == line -> args + 1 || end[0] != ',' || end[1] != ' ')
+			return false;
+
+		*dest = end + 2;
+		*len = strlen(*dest);
+	}
+
+	const char *last = *dest + *len - 1;
+
+	if(nasm_syntax) *byte = !strncmp(*dest, "byte ", 5)
+		|| (*len == 2 && (*last == 'l' || *last == 'h'));
+
+	else if(*suffix) *byte = *suffix == 'b';
+	else *byte = *last == 'b' || (*len == 3 && *last == 'l');
+
+	return true;
+}
+
+static bool conditional(size_t i) {
+	return i < line_count && lines[i].kind == LINE_INSTR
+		&& lines[i].mnem[0] == 'j' && strcmp(lines[i].mnem, "jmp");
+}
+
+static bool zero_test(size_t i) {
+	return i < line_count && lines[i].kind == LINE_INSTR
+		&& (!strcmp(lines[i].mnem, "je") || !strcmp(lines[i].mnem, "jne")
+		|| !strcmp(lines[i].mnem, "jz") || !strcmp(lines[i].mnem, "jnz"));
+}
+
+static const char *operand(const char *str, size_t *len) {
+	if(!strncmp(str, "byte ", 5)) { str += 5; *len -= 5; }
+	return str;
+}
+
+static void fold() {
+	for(size_t i = 0; i < line_count; i++) {
+		const char *dest;
+		size_t len;
+		long value;
+		bool byte, changed = false;
+
+		if(lines[i].dead) continue;
+		if(!immediate(&lines[i], &dest, &len, &value, &byte)) continue;
+
+		for(size_t j = next_line(i); j < line_count; j = next_line(i)) {
+			const char *dest2;
+			size_t len2;
+			long value2;
+			bool byte2;
+
+			if(!immediate(&lines[j], &dest2, &len2, &value2, &byte2))
+				break;
+
+			if(len != len2 || strncmp(dest, dest2, len) || byte != byte2)
+				break;
+
+			if(conditional(next_line(j))) break;
+
+			value += value2;
+			if(byte) value &= 0xff;
+
+			kill(j);
+			changed = true;
+
+			if(!value) { kill(i); break; }
+		}
+
+		if(!changed || lines[i].dead) continue;
+
+		char *mnem = malloc(len + 64);
+		if(!mnem) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+		bool add = byte? value <= 128: value > 0;
+		if(!add) value = byte? 256 - value: -value;
+
+		const char *suffix = nasm_syntax? "": lines[i].mnem + 3;
+		int skip = sprintf(mnem, "%s%s", add? "add": "sub", suffix) + 1;
+
+		if(nasm_syntax)
+			sprintf(mnem + skip, "%.*s, %ld", (int) len, dest, value);
+		else sprintf(mnem + skip, "$%ld, %.*s", value, (int) len, dest);
+
+		if(lines[i].owned) free(lines[i].mnem);
+		lines[i].mnem = mnem;
+		lines[i].args = mnem + skip;
+		lines[i].owned = true;
+	}
+}
+
+static void thread() {
+	index_labels();
+
+	for(size_t i = 0; i < line_count; i++) {
+		line_t *line = &lines[i];
+
+		if(line -> dead || line -> kind != LINE_INSTR) continue;
+		if(line -> mnem[0] != 'j' || !line -> args) continue;
+
+		label_t *label = find_label(line -> args);
+		if(!label || !label -> unique) continue;
+
+		for(size_t hops = 0; hops < MAX_HOPS; hops++) {
+			size_t j = label -> index;
+
+			while(j < line_count && (lines[j].dead
+				|| lines[j].kind == LINE_BLANK
+				|| lines[j].kind == LINE_LABEL)) j++;
+
+			if(j == line_count || lines[j].kind != LINE_INSTR) break;
+			if(strcmp(lines[j].mnem, "jmp") || !lines[j].args) break;
+
+			label_t *next = find_label(lines[j].args);
+			if(!next || !next -> unique || next == label) break;
+
+			line -> args = (char *) next -> name;
+			label = next;
+		}
+
+		if(strcmp(line -> mnem, "jmp")) continue;
+
+		for(size_t j = i + 1; j < line_count; j++) {
+			if(j == label -> index) { kill(i); break; }
+
+			if(lines[j].dead || lines[j].kind == LINE_BLANK) continue;
+			if(lines[j].kind != LINE_LABEL) break;
+		}
+	}
+}
+
+static void prune() {
+	for(size_t i = 0; i < line_count; i++) {
+		if(lines[i].dead) continue;
+
+		const char *str;
+		if(lines[i].kind == LINE_INSTR) str = lines[i].args;
+		else if(lines[i].kind == LINE_OTHER) str = lines[i].text;
+		else continue;
+
+		while(str && *str) {
+			size_t len = 0;
+			while(isalnum(str[len]) || str[len] == '_' || str[len] == '.')
+				len++;
+
+			if(!len) { str++; continue; }
+
+			char name[len + 1];
+			memcpy(name, str, len);
+			name[len] = 0;
+
+			label_t *label = find_label(name);
+			if(label) label -> used = true;
+
+			str += len;
+		}
+	}
+
+	for(size_t i = 0; i < label_count; i++) {
+		if(labels[i].used || labels[i].name[0] != '.') continue;
+
+		size_t j = labels[i].index;
+		kill(j);
+
+		if(j && lines[j - 1].kind == LINE_BLANK) lines[j - 1].dead = true;
+	}
+}
+
+static void reuse_flags() {
+	for(size_t i = 0; i < line_count; i++) {
+		line_t *line = &lines[i];
+		if(line -> dead || line -> kind != LINE_INSTR || !line -> args) continue;
+
+		const char *test;
+		size_t len = strlen(line -> args);
+
+		if(nasm_syntax) {
+			if(strcmp(line -> mnem, "cmp") || len < 4) continue;
+			if(strcmp(line -> args + len - 3, ", 0")) continue;
+
+			len -= 3;
+			test = operand(line -> args, &len);
+		}
+
+		else {
+			if(strcmp(line -> mnem, "cmpb")) continue;
+			if(strncmp(line -> args, "$0, ", 4)) continue;
+
+			test = line -> args + 4;
+			len -= 4;
+		}
+
+		if(!zero_test(next_line(i))) continue;
+
+		size_t j = prev_line(i);
+		if(j == line_count || lines[j].kind != LINE_INSTR) continue;
+
+		const char *mnem = lines[j].mnem, *args = lines[j].args;
+		if(!args) continue;
+
+		static const char *ops[] = {
+			"add", "sub", "inc", "dec", "neg", "and", "or", "xor", NULL
+		};
+
+		size_t k, base;
+		for(k = 0; ops[k]; k++)
+			if(!strncmp(mnem, ops[k], strlen(ops[k]))) break;
+
+		if(!ops[k]) continue;
+		base = strlen(ops[k]);
+
+		const char *dest;
+		size_t dest_len;
+
+		if(nasm_syntax) {
+			if(mnem[base]) continue;
+
+			const char *comma = strchr(args, ',');
+			dest_len = comma? (size_t) (comma - args): strlen(args);
+			dest = operand(args, &dest_len);
+		}
+
+		else {
+			if(strcmp(mnem + base, "b")) continue;
+
+			const char *comma = strrchr(args, ',');
+			dest = comma? comma + 2: args;
+			dest_len = strlen(dest);
+		}
+
+		if(dest_len == len && !strncmp(dest, test, len)) kill(i);
+	}
+}
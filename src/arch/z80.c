@@ -105,14 +105,16 @@ void BFa_z80_t(FILE *file) {
 			break;
 
 		case BFI_INSTR_LOOP:
-			fprintf(file, "\n.l%zu:\n", op1);
 			fprintf(file, "\tld\ta, (hl)\n");
 			fprintf(file, "\tand\ta\n");
 			fprintf(file, "\tjp\tz, .e%zu\n", op1);
+			fprintf(file, "\n.l%zu:\n", op1);
 			break;
 
 		case BFI_INSTR_ENDL:
-			fprintf(file, "\tjp\t.l%zu\n", op1);
+			fprintf(file, "\tld\ta, (hl)\n");
+			fprintf(file, "\tand\ta\n");
+			fprintf(file, "\tjp\tnz, .l%zu\n", op1);
 			fprintf(file, "\n.e%zu:\n", op1);
 			break;
 
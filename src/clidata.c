@@ -32,11 +32,16 @@ size_t BFc_width = 80;
 
 bool BFc_no_ansi;
 bool BFc_direct_inp;
+bool BFc_batch_inp;
+bool BFc_jit;
 bool BFc_minimal_mode;
 
 struct termios BFc_cooked, BFc_raw;
 
 void BFc_init() {
+        if(!isatty(STDIN_FILENO)) BFc_batch_inp = true;
+        if(BFc_batch_inp) return;
+
         int ret = tcgetattr(STDIN_FILENO, &BFc_cooked);
         if(ret == -1) BFe_report_err(BFE_UNKNOWN_ERROR);
 
@@ -48,7 +53,7 @@ void BFc_init() {
 }
 
 void BFc_get_dimensions() {
-        if(BFc_no_ansi) return;
+        if(BFc_no_ansi || BFc_batch_inp) return;
 
         BFc_raw.c_lflag &= ~ECHO;
         int ret = tcsetattr(STDIN_FILENO, TCSANOW, &BFc_raw);
@@ -65,4 +70,11 @@ void BFc_get_dimensions() {
         if(ret == -1) BFe_report_err(BFE_UNKNOWN_ERROR);
 
         if(BFc_minimal_mode && BFc_width > 80) BFc_width = 80;
-}
\ No newline at end of file
+}
+
+void BFc_set_term(const struct termios *term) {
+        if(BFc_batch_inp) return;
+
+        int ret = tcsetattr(STDIN_FILENO, TCSANOW, term);
+        if(ret == -1) BFe_report_err(BFE_UNKNOWN_ERROR);
+}
@@ -31,11 +31,14 @@ extern size_t BFc_width;
 
 extern bool BFc_no_ansi;
 extern bool BFc_direct_inp;
+extern bool BFc_batch_inp;
+extern bool BFc_jit;
 extern bool BFc_minimal_mode;
 
 extern struct termios BFc_cooked, BFc_raw;
 
 extern void BFc_init();
 extern void BFc_get_dimensions();
+extern void BFc_set_term(const struct termios *term);
 
 #endif
\ No newline at end of file
@@ -57,8 +57,7 @@ void BFf_init() {
 			BF_FILENAME_SIZE - 1);
 		get_file();
 
-		int ret = tcsetattr(STDIN_FILENO, TCSANOW, &BFc_raw);
-		if(ret == -1) BFe_report_err(BFE_UNKNOWN_ERROR);
+		BFc_set_term(&BFc_raw);
 
 		BFi_is_running = true;
 		BFi_last_output = '\n';
@@ -66,8 +65,7 @@ void BFf_init() {
 
 		if(BFi_last_output != '\n') putchar('\n');
 
-		ret = tcsetattr(STDIN_FILENO, TCSANOW, &BFc_cooked);
-		if(ret == -1) BFe_report_err(BFE_UNKNOWN_ERROR);
+		BFc_set_term(&BFc_cooked);
 
 		exit(0);
 	}
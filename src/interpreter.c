@@ -14,12 +14,21 @@
  * You should have received a copy of the GNU General Public License along with
  * this program. If not, see <https://www.gnu.org/licenses/>. */
 
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include <LC_editor.h>
 #include <LC_lines.h>
 
@@ -27,18 +36,33 @@
 #include "errors.h"
 #include "files.h"
 #include "interpreter.h"
+#include "jit.h"
 #include "main.h"
+#include "optims.h"
 #include "printing.h"
+#include "translator.h"
 
 #define COMMAND_STRING 0
 #define PROGRAM_STRING 1
 #define PARTIAL_OUTPUT 2
 
+#define GUARD_SIZE ((size_t) 1 << (SIZE_MAX > UINT32_MAX ? 30 : 24))
+#define INPUT_SIZE 65536
+#define OUTPUT_SIZE 65536
+
 char *BFi_program_str;
 BFi_instr_t *BFi_code;
 size_t BFi_code_size = BF_CODE_SIZE;
 
-static BFi_instr_t *cmd_code;
+BFi_op_t *BFi_bytecode;
+size_t BFi_bytecode_len;
+
+static BFi_op_t *cmd_code;
+static BFi_op_t **call_stack;
+static bool jit_ready;
+
+static sigjmp_buf *fault_env;
+static char output[OUTPUT_SIZE];
 
 bool BFi_do_recompile = true;
 bool BFi_is_running;
@@ -49,26 +73,53 @@ size_t BFi_mem_ptr;
 size_t BFi_mem_size = BF_MEM_SIZE;
 
 static BFi_instr_t *compile(char *str, int mode);
-static void run(BFi_instr_t *instr);
+static BFi_op_t *lower(BFi_instr_t *code, size_t *length);
+static void guard(BFi_op_t *code);
+static void run(BFi_op_t *instr);
 
 static void append_simple(BFi_instr_t **current, int opcode);
 static void append_cmplx(BFi_instr_t **current, int *opcode, size_t *op,
 			 int context);
 
 static char get_input();
+static char read_input();
+static void put_output(char ch);
+static void segfault();
+static void handle_segv(int signum, siginfo_t *info, void *context);
 
-static void _on_fwd(size_t op) { (void) op; }
-static void _on_bck(size_t op) { (void) op; }
+int (*BFi_putchar)(int ch) = putchar_unlocked;
 
-int (*BFi_putchar)(int ch) = putchar;
-void (*BFi_on_fwd)(size_t op) = _on_fwd;
-void (*BFi_on_bck)(size_t op) = _on_bck;
+/* The tape sits between two PROT_NONE regions, so the handlers in run() and
+ * the JIT never compare the pointer against the tape size. Between two cell
+ * accesses the pointer can only drift by as much as straight-line code moves
+ * it, which GUARD_SIZE covers for any realistic program. */
 
 void BFi_init() {
+	size_t page = sysconf(_SC_PAGESIZE);
+
 	if(!BFi_mem_size) BFi_mem_size++;
+	BFi_mem_size = (BFi_mem_size + page - 1) / page * page;
+
+	unsigned char *map = mmap(NULL, BFi_mem_size + GUARD_SIZE * 2,
+		PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if(map == MAP_FAILED) BFe_report_err(BFE_UNKNOWN_ERROR);
+	BFi_mem = map + GUARD_SIZE;
+
+	int ret = mprotect(BFi_mem, BFi_mem_size, PROT_READ | PROT_WRITE);
+	if(ret == -1) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	struct sigaction action = {0};
+	action.sa_sigaction = handle_segv;
+	action.sa_flags = SA_SIGINFO | SA_NODEFER;
+
+	ret = sigaction(SIGSEGV, &action, NULL);
+	if(ret == -1) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	ret = setvbuf(stdout, output, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF,
+		OUTPUT_SIZE);
 
-	BFi_mem = calloc(BFi_mem_size, sizeof(unsigned char));
-	if(!BFi_mem) BFe_report_err(BFE_UNKNOWN_ERROR);
+	if(ret) BFe_report_err(BFE_UNKNOWN_ERROR);
 }
 
 void BFi_compile(bool translate) {
@@ -78,29 +129,43 @@ void BFi_compile(bool translate) {
 		free(instr);
 	}
 
-	if(!translate) {
+	if(translate) {
+		BFi_code = compile(BFi_program_str, PARTIAL_OUTPUT);
+		return;
+	}
+
+	if(BFo_level == '0' || BFt_translate)
 		BFi_code = compile(BFi_program_str, PROGRAM_STRING);
-		BFi_do_recompile = false;
+
+	else {
+		BFo_zeroed_mem = BFc_immediate != NULL;
+		BFo_keep_ptr = BFc_immediate == NULL;
+		BFo_optimise();
 	}
 
-	else BFi_code = compile(BFi_program_str, PARTIAL_OUTPUT);
+	if(BFi_bytecode) free(BFi_bytecode);
+	BFi_bytecode = lower(BFi_code, &BFi_bytecode_len);
+	BFi_code = NULL;
+
+	if(BFc_jit && !BFt_translate) jit_ready = BFj_compile(BFi_bytecode,
+		BFi_bytecode_len, get_input, put_output);
+
+	BFi_do_recompile = false;
 	return;
 }
 
 void BFi_main(char *command_str) {
-	while(cmd_code) {
-		BFi_instr_t *instr = cmd_code;
-		cmd_code = instr -> next;
-		free(instr);
-	}
+	if(cmd_code) free(cmd_code);
 
-	cmd_code = compile(command_str, COMMAND_STRING);
-	run(cmd_code);
+	cmd_code = lower(compile(command_str, COMMAND_STRING), NULL);
+	guard(cmd_code);
 }
 
 void BFi_exec() {
 	if(BFi_do_recompile) BFi_compile(false);
-	run(BFi_code);
+
+	if(jit_ready && !BFt_translate) guard(NULL);
+	else guard(BFi_bytecode);
 }
 
 static BFi_instr_t *compile(char *str, int mode) {
@@ -272,7 +337,13 @@ static void append_cmplx(BFi_instr_t **current, int *opcode, size_t *op,
 
 		(*current) -> next -> prev = *current;
 		(*current) -> next -> next = NULL;
+		(*current) -> next -> ptr = NULL;
+
 		(*current) -> next -> opcode = BFI_INSTR_NOP;
+		(*current) -> next -> op1 = 0;
+		(*current) -> next -> op2 = 0;
+		(*current) -> next -> ad1 = 0;
+		(*current) -> next -> ad2 = 0;
 
 		(*current) = (*current) -> next;
 		*opcode = context;
@@ -285,7 +356,155 @@ static void append_cmplx(BFi_instr_t **current, int *opcode, size_t *op,
 	return;
 }
 
-static void run(BFi_instr_t *instr) {
+/* Packs a compiled program into one contiguous array for run(), freeing the
+ * linked list as it goes. NOPs and ENDIFs are dropped, jumps are resolved to
+ * indices relative to the jumping instruction with the cell they test moved
+ * to ad2, JZ and JMP take on the same meaning as LOOP and ENDL, block
+ * operations keep their length in ad2 and their table offset in ad3, and a
+ * RET marks the end of the array. */
+
+static BFi_op_t *lower(BFi_instr_t *code, size_t *length) {
+	size_t len = 1, loops = 0, subs = 0;
+
+	for(BFi_instr_t *instr = code; instr; instr = instr -> next) {
+		switch(instr -> opcode) {
+		case BFI_INSTR_NOP: case BFI_INSTR_ENDIF:
+			continue;
+
+		case BFI_INSTR_FWD: case BFI_INSTR_BCK:
+			len += (instr -> op1 + INT32_MAX - 1) / INT32_MAX;
+			continue;
+
+		case BFI_INSTR_JZ: case BFI_INSTR_LOOP: case BFI_INSTR_IFNZ:
+			loops++;
+			break;
+
+		case BFI_INSTR_SUB:
+			if(instr -> op1 > subs) subs = instr -> op1;
+		}
+
+		len++;
+	}
+
+	BFi_op_t *ops = malloc(sizeof(BFi_op_t) * len);
+	size_t *stack = malloc(sizeof(size_t) * (loops + 1));
+	size_t *table = malloc(sizeof(size_t) * (subs + 1));
+	if(!(ops && stack && table)) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	if(subs) {
+		if(call_stack) free(call_stack);
+		call_stack = malloc(sizeof(BFi_op_t *) * (subs + 1));
+		if(!call_stack) BFe_report_err(BFE_UNKNOWN_ERROR);
+	}
+
+	size_t i = 0;
+	loops = 0;
+
+	while(code) {
+		BFi_instr_t *instr = code;
+		BFi_op_t *op = &ops[i];
+
+		op -> opcode = instr -> opcode;
+		op -> op1 = instr -> op1;
+		op -> op2 = instr -> op2;
+		op -> ad1 = instr -> ad1;
+		op -> ad2 = instr -> ad2;
+		op -> ad3 = instr -> opcode == BFI_INSTR_PRDA ?
+			(ssize_t) instr -> op2 : 0;
+
+		switch(instr -> opcode) {
+		case BFI_INSTR_NOP:
+			goto next;
+
+		case BFI_INSTR_FWD: case BFI_INSTR_BCK:
+			for(size_t j = instr -> op1; j; i++) {
+				size_t step = j < INT32_MAX ? j : INT32_MAX;
+
+				ops[i].opcode = instr -> opcode;
+				ops[i].op1 = ops[i].op2 = 0;
+				ops[i].ad1 = step;
+				ops[i].ad2 = ops[i].ad3 = 0;
+
+				j -= step;
+			}
+
+			goto next;
+
+		case BFI_INSTR_JZ: case BFI_INSTR_LOOP: case BFI_INSTR_IFNZ:
+			stack[loops++] = i;
+			op -> ad2 = instr -> ad1;
+			break;
+
+		case BFI_INSTR_JMP: case BFI_INSTR_ENDL:
+			op -> ad2 = instr -> ad1;
+			loops--;
+			ops[stack[loops]].ad1 = i - stack[loops];
+			op -> ad1 = stack[loops] - i;
+			break;
+
+		case BFI_INSTR_ENDIF:
+			loops--;
+			ops[stack[loops]].ad1 = i - stack[loops] - 1;
+			goto next;
+
+		case BFI_INSTR_SUB:
+			table[instr -> op1] = i;
+			break;
+
+		case BFI_INSTR_JSR:
+			op -> ad1 = instr -> op1;
+			break;
+
+		case BFI_INSTR_SETB: case BFI_INSTR_ADDB:
+			op -> ad2 = instr -> op1;
+			op -> ad3 = instr -> op2;
+		}
+
+		i++;
+
+	next:	code = instr -> next;
+		free(instr);
+	}
+
+	ops[i].opcode = BFI_INSTR_RET;
+	ops[i].op1 = ops[i].op2 = 0;
+	ops[i].ad1 = ops[i].ad2 = ops[i].ad3 = 0;
+
+	for(size_t j = 0; j < i; j++)
+		if(ops[j].opcode == BFI_INSTR_JSR)
+			ops[j].ad1 = table[ops[j].ad1] - j;
+
+	free(stack);
+	free(table);
+
+	if(length) *length = len;
+	return ops;
+}
+
+static void guard(BFi_op_t *code) {
+	sigjmp_buf env, *outer = fault_env;
+
+	if(sigsetjmp(env, true)) {
+		fault_env = outer;
+		segfault();
+		return;
+	}
+
+	fault_env = &env;
+
+	if(code) run(code);
+	else BFj_exec();
+
+	fault_env = outer;
+	fflush(stdout);
+
+	if(BFi_mem_ptr < BFi_mem_size) return;
+
+	BFi_mem_ptr = BFi_mem_ptr > SIZE_MAX / 2 ? 0 : BFi_mem_size - 1;
+	segfault();
+}
+
+static void run(BFi_op_t *instr) {
 	static const void *jump_table[] = {
 		[BFI_INSTR_NOP] = &&nop,
 		[BFI_INSTR_INC]	= &&inc,
@@ -294,8 +513,8 @@ static void run(BFi_instr_t *instr) {
 		[BFI_INSTR_BCK] = &&bck,
 		[BFI_INSTR_INP] = &&inp,
 		[BFI_INSTR_OUT] = &&out,
-		[BFI_INSTR_JMP] = &&jmp,
-		[BFI_INSTR_JZ]  = &&jz,
+		[BFI_INSTR_JMP] = &&endl,
+		[BFI_INSTR_JZ]  = &&loop,
 
 		[BFI_INSTR_HELP] = &&help,
 		[BFI_INSTR_INIT] = &&init,
@@ -305,103 +524,287 @@ static void run(BFi_instr_t *instr) {
 
 		[BFI_INSTR_EXEC] = &&exec,
 		[BFI_INSTR_EDIT] = &&edit,
-		[BFI_INSTR_COMP] = &&comp
+		[BFI_INSTR_COMP] = &&comp,
+
+		[BFI_INSTR_LOOP] = &&loop,
+		[BFI_INSTR_ENDL] = &&endl,
+		[BFI_INSTR_IFNZ] = &&ifnz,
+		[BFI_INSTR_ENDIF] = &&nop,
+
+		[BFI_INSTR_CMPL] = &&cmpl,
+		[BFI_INSTR_MOV] = &&mov,
+
+		[BFI_INSTR_MULA] = &&mula,
+		[BFI_INSTR_MULS] = &&muls,
+		[BFI_INSTR_MULM] = &&mulm,
+
+		[BFI_INSTR_SHLA] = &&shla,
+		[BFI_INSTR_SHLS] = &&shls,
+		[BFI_INSTR_SHLM] = &&shlm,
+
+		[BFI_INSTR_CPYA] = &&cpya,
+		[BFI_INSTR_CPYS] = &&cpys,
+		[BFI_INSTR_CPYM] = &&cpym,
+
+		[BFI_INSTR_SUB] = &&end,
+		[BFI_INSTR_JSR] = &&jsr,
+		[BFI_INSTR_RTS] = &&rts,
+		[BFI_INSTR_RET] = &&end,
+
+		[BFI_INSTR_SCAN] = &&scan,
+		[BFI_INSTR_PRDA] = &&prda,
+
+		[BFI_INSTR_SETB] = &&setb,
+		[BFI_INSTR_ADDB] = &&addb
 	};
 
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+	size_t depth = 0, addr, src;
+	unsigned char *cell;
+
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
-nop:	instr = instr -> next;
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+nop:	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
 inc:
-	BFi_mem[BFi_mem_ptr] += instr -> op1;
+	BFi_mem[BFi_mem_ptr + instr -> ad1] += instr -> op1;
 
-	instr = instr -> next;
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
 dec:
-	BFi_mem[BFi_mem_ptr] -= instr -> op1;
+	BFi_mem[BFi_mem_ptr + instr -> ad1] -= instr -> op1;
 
-	instr = instr -> next;
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
 fwd:
-	BFi_mem_ptr += instr -> op1;
-	if(BFi_mem_ptr >= BFi_mem_size) {
-		BFi_mem_ptr -= instr -> op1;
+	BFi_mem_ptr += instr -> ad1;
 
-		BFe_file_name = BFc_immediate
-			? BFf_mainfile_name
-			: BFc_cmd_name;
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
 
-		if(BFi_last_output != '\n') putchar('\n');
-		BFe_report_err(BFE_SEGFAULT);
-		putchar('\n');
+bck:
+	BFi_mem_ptr -= instr -> ad1;
 
-		BFi_last_output = '\n';
-		return;
-	}
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
+
+inp:
+	BFi_mem[BFi_mem_ptr + instr -> ad1] = get_input();
+
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
 
-	BFi_on_fwd(instr -> op1);
+out:
+	put_output(BFi_mem[BFi_mem_ptr + instr -> ad1]);
 
-	instr = instr -> next;
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
-bck:
-	BFi_mem_ptr -= instr -> op1;
-	if(BFi_mem_ptr >= BFi_mem_size) {
-		BFi_mem_ptr += instr -> op1;
+loop:
+	if(!BFi_mem[BFi_mem_ptr + instr -> ad2]) instr += instr -> ad1;
+
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
 
-		BFe_file_name = BFc_immediate
-			? BFf_mainfile_name
-			: BFc_cmd_name;
+endl:
+	if(BFi_mem[BFi_mem_ptr + instr -> ad2]) instr += instr -> ad1;
 
-		if(BFi_last_output != '\n') putchar('\n');
-		BFe_report_err(BFE_SEGFAULT);
-		putchar('\n');
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
 
-		BFi_last_output = '\n';
-		return;
+ifnz:
+	if(!BFi_mem[BFi_mem_ptr + instr -> ad2]) instr += instr -> ad1;
+
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
+
+cmpl:
+	BFi_mem[BFi_mem_ptr + instr -> ad1] = -BFi_mem[BFi_mem_ptr + instr -> ad1];
+
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
+
+mov:
+	BFi_mem[BFi_mem_ptr + instr -> ad1] = instr -> op1;
+
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
+
+mula:
+	src = BFi_mem_ptr + instr -> ad2;
+	if(!BFi_mem[src]) goto mula_n;
+	BFi_mem[BFi_mem_ptr + instr -> ad1] += BFi_mem[src] * instr -> op1;
+
+mula_n:	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
+
+muls:
+	src = BFi_mem_ptr + instr -> ad2;
+	if(!BFi_mem[src]) goto muls_n;
+	BFi_mem[BFi_mem_ptr + instr -> ad1] -= BFi_mem[src] * instr -> op1;
+
+muls_n:	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
+
+	/* A zero source must still clear a cell whose MOV the optimiser folded
+	 * away, but not one that the original loop would never have reached. */
+
+mulm:
+	src = BFi_mem_ptr + instr -> ad2;
+	addr = BFi_mem_ptr + instr -> ad1;
+
+	if(!BFi_mem[src] && addr >= BFi_mem_size) goto mulm_n;
+	BFi_mem[addr] = BFi_mem[src] * instr -> op1;
+
+mulm_n:	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
+
+shla:
+	src = BFi_mem_ptr + instr -> ad2;
+	if(!BFi_mem[src]) goto shla_n;
+	BFi_mem[BFi_mem_ptr + instr -> ad1] += BFi_mem[src] << instr -> op2;
+
+shla_n:	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
+
+shls:
+	src = BFi_mem_ptr + instr -> ad2;
+	if(!BFi_mem[src]) goto shls_n;
+	BFi_mem[BFi_mem_ptr + instr -> ad1] -= BFi_mem[src] << instr -> op2;
+
+shls_n:	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
+
+shlm:
+	src = BFi_mem_ptr + instr -> ad2;
+	addr = BFi_mem_ptr + instr -> ad1;
+
+	if(!BFi_mem[src] && addr >= BFi_mem_size) goto shlm_n;
+	BFi_mem[addr] = BFi_mem[src] << instr -> op2;
+
+shlm_n:	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
+
+cpya:
+	src = BFi_mem_ptr + instr -> ad2;
+	if(!BFi_mem[src]) goto cpya_n;
+	BFi_mem[BFi_mem_ptr + instr -> ad1] += BFi_mem[src];
+
+cpya_n:	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
+
+cpys:
+	src = BFi_mem_ptr + instr -> ad2;
+	if(!BFi_mem[src]) goto cpys_n;
+	BFi_mem[BFi_mem_ptr + instr -> ad1] -= BFi_mem[src];
+
+cpys_n:	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
+
+cpym:
+	src = BFi_mem_ptr + instr -> ad2;
+	addr = BFi_mem_ptr + instr -> ad1;
+
+	if(!BFi_mem[src] && addr >= BFi_mem_size) goto cpym_n;
+	BFi_mem[addr] = BFi_mem[src];
+
+cpym_n:	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
+
+	/* Unit strides go through the libc routines, which pick a vector kernel
+	 * for the host at load time. A scan that runs off the tape leaves the
+	 * pointer out of range for guard() to report. */
+
+scan:
+	if(BFi_mem_ptr >= BFi_mem_size) goto end;
+
+	switch(instr -> ad1) {
+	case 1:
+		cell = memchr(&BFi_mem[BFi_mem_ptr], 0,
+			BFi_mem_size - BFi_mem_ptr);
+
+		if(!cell) { BFi_mem_ptr = BFi_mem_size; goto end; }
+		BFi_mem_ptr = cell - BFi_mem;
+		break;
+
+	case -1:
+		cell = memrchr(BFi_mem, 0, BFi_mem_ptr + 1);
+
+		if(!cell) { BFi_mem_ptr = SIZE_MAX; goto end; }
+		BFi_mem_ptr = cell - BFi_mem;
+		break;
+
+	default:
+		while(BFi_mem[BFi_mem_ptr]) BFi_mem_ptr += instr -> ad1;
 	}
 
-	BFi_on_bck(instr -> op1);
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
+	else goto end;
+
+prda:
+	src = BFi_mem_ptr + instr -> ad3;
+	if(!BFi_mem[src] || !BFi_mem[BFi_mem_ptr + instr -> ad2]) goto prda_n;
+
+	BFi_mem[BFi_mem_ptr + instr -> ad1] += BFi_mem[src] * instr -> op1
+		* BFi_mem[BFi_mem_ptr + instr -> ad2];
 
-	instr = instr -> next;
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+prda_n:	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
-inp:
-	BFi_mem[BFi_mem_ptr] = get_input();
+setb:
+	memcpy(&BFi_mem[BFi_mem_ptr + instr -> ad1], &BFo_blocks[instr -> ad3],
+		instr -> ad2);
 
-	instr = instr -> next;
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
-out:
-	BFi_last_output = BFi_mem[BFi_mem_ptr];
-	BFi_putchar(BFi_mem[BFi_mem_ptr]);
-	fflush(stdout);
+addb:
+	cell = &BFi_mem[BFi_mem_ptr + instr -> ad1];
+	for(int32_t i = 0; i < instr -> ad2; i++)
+		cell[i] += BFo_blocks[instr -> ad3 + i];
 
-	instr = instr -> next;
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
-jmp:
-	instr = instr -> ptr;
+jsr:
+	call_stack[depth++] = instr + 1;
+	instr += instr -> ad1 + 1;
 
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
-jz:
-	if(BFi_mem[BFi_mem_ptr]) instr = instr -> next;
-	else instr = instr -> ptr;
-	
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+rts:
+	instr = call_stack[--depth];
+
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
 help:
@@ -415,8 +818,8 @@ help:
 
 	BFi_last_output = '\n';
 
-	instr = instr -> next;
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
 init:
@@ -425,8 +828,8 @@ init:
 
 	BFi_mem_ptr = 0;
 
-	instr = instr -> next;
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
 peek:
@@ -438,8 +841,8 @@ peek:
 
 	BFi_last_output = '\n';
 
-	instr = instr -> next;
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
 dump:
@@ -456,40 +859,38 @@ dump:
 
 	BFi_last_output = '\n';
 
-dump_n:	instr = instr -> next;
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+dump_n:	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
 exec:
 	BFi_exec();
 
-	instr = instr -> next;
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
 edit:
-	if(BFc_no_ansi) {
+	if(BFc_no_ansi || BFc_batch_inp) {
 		if(!strlen(BFi_program_str)) goto edit_n;
 		printf("\n%s\n\n", BFi_program_str);
 		BFi_last_output = '\n';
 		goto edit_n;
 	}
 
-	int ret = tcsetattr(STDIN_FILENO, TCSANOW, &BFc_cooked);
-	if(ret == -1) BFe_report_err(BFE_UNKNOWN_ERROR);
+	BFc_set_term(&BFc_cooked);
 
-	ret = LCe_edit();
+	int ret = LCe_edit();
 	if(ret != LCE_OK) BFe_report_err(BFE_UNKNOWN_ERROR);
 
-	ret = tcsetattr(STDIN_FILENO, TCSANOW, &BFc_raw);
-	if(ret == -1) BFe_report_err(BFE_UNKNOWN_ERROR);
+	BFc_set_term(&BFc_raw);
 
 	printf("\e[H\e[J");
 	BFi_do_recompile = true;
 	BFi_last_output = '\n';
 
-edit_n:	instr = instr -> next;
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+edit_n:	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
 comp:
@@ -501,8 +902,8 @@ comp:
 
 	BFi_last_output = '\n';
 
-	instr = instr -> next;
-	if(instr && BFi_is_running) goto *jump_table[instr -> opcode];
+	instr++;
+	if(BFi_is_running) goto *jump_table[instr -> opcode];
 	else goto end;
 
 end:	return;
@@ -510,18 +911,24 @@ end:	return;
 
 static char get_input() {
 	static char input[BF_LINE_SIZE];
-	static size_t length = 0;
+	static size_t length = 0, pos = 0;
+
+	if(BFc_batch_inp && BFc_immediate) return read_input();
 
+	fflush(stdout);
 	if(BFc_direct_inp) return getchar();
 
-	while(!strlen(input)) {
-		int ret = tcsetattr(STDIN_FILENO, TCSANOW, &BFc_cooked);
-		if(ret == -1) BFe_report_err(BFE_UNKNOWN_ERROR);
+	while(pos == length) {
+		BFc_set_term(&BFc_cooked);
 
+		input[0] = 0;
 		LCl_buffer = input;
 		LCl_length = BF_LINE_SIZE - 1;
 
-		if(BFc_no_ansi) ret = LCl_bread(input, BF_LINE_SIZE - 1);
+		int ret;
+		if(BFc_no_ansi || BFc_batch_inp)
+			ret = LCl_bread(input, BF_LINE_SIZE - 1);
+
 		else ret = LCl_read();
 
 		switch(ret) {
@@ -538,19 +945,76 @@ static char get_input() {
 			BFe_report_err(BFE_UNKNOWN_ERROR);
 		}
 
-		ret = tcsetattr(STDIN_FILENO, TCSANOW, &BFc_raw);
-		if(ret == -1) BFe_report_err(BFE_UNKNOWN_ERROR);
+		BFc_set_term(&BFc_raw);
 
 		length = strlen(input);
-		input[length + 1] = 0;
-		input[length] = '\n';
-		length++;
+		input[length++] = '\n';
+		pos = 0;
 	}
 
-	char ret = input[0];
-	for(size_t i = 1; i <= length; i++)
-		input[i - 1] = input[i];
+	return input[pos++];
+}
+
+/* When a file is run with stdin redirected, input is taken straight from the
+ * file descriptor in large blocks, bypassing both stdio and the line editor.
+ * Output is only flushed when a new block has to be read, and as with -d, the
+ * end of the input reads as EOF. */
+
+static char read_input() {
+	static char input[INPUT_SIZE];
+	static size_t length = 0, pos = 0;
+
+	if(pos == length) fflush(stdout);
+
+	while(pos == length) {
+		ssize_t ret = read(STDIN_FILENO, input, INPUT_SIZE);
+
+		if(ret == -1 && errno == EINTR && BFi_is_running) continue;
+		if(ret == -1 && errno != EINTR) BFe_report_err(BFE_UNKNOWN_ERROR);
+		if(ret <= 0) return EOF;
+
+		length = ret;
+		pos = 0;
+	}
+
+	return input[pos++];
+}
+
+/* Output collects in stdout's buffer, which is line-buffered on a terminal
+ * and fully buffered otherwise. It is flushed before any input is read and
+ * whenever guard() regains control, including after a Ctrl-C. */
+
+static void put_output(char ch) {
+	BFi_last_output = ch;
+	BFi_putchar(ch);
+}
+
+static void segfault() {
+	BFe_file_name = BFc_immediate
+		? BFf_mainfile_name
+		: BFc_cmd_name;
+
+	if(BFi_last_output != '\n') putchar('\n');
+	fflush(stdout);
+
+	BFe_report_err(BFE_SEGFAULT);
+	putchar('\n');
+
+	BFi_last_output = '\n';
+}
+
+static void handle_segv(int signum, siginfo_t *info, void *context) {
+	unsigned char *addr = info -> si_addr;
+	(void) context;
+
+	bool in_guard = addr >= BFi_mem - GUARD_SIZE
+		&& addr < BFi_mem + BFi_mem_size + GUARD_SIZE;
+
+	if(!fault_env || !in_guard) {
+		signal(signum, SIG_DFL);
+		return;
+	}
 
-	length--;
-	return ret;
+	BFi_mem_ptr = addr < BFi_mem ? 0 : BFi_mem_size - 1;
+	siglongjmp(*fault_env, true);
 }
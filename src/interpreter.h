@@ -16,6 +16,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include <sys/types.h>
 
@@ -74,12 +75,29 @@ typedef struct BFi_instr_s {
 	#define BFI_INSTR_RTS 33
 	#define BFI_INSTR_RET 34
 
+	#define BFI_INSTR_SCAN 35
+	#define BFI_INSTR_PRDA 36
+
+	#define BFI_INSTR_SETB 37
+	#define BFI_INSTR_ADDB 38
+
 } BFi_instr_t;
 
+typedef struct {
+	unsigned char opcode;
+	unsigned char op1, op2;
+
+	int32_t ad1, ad2, ad3;
+
+} BFi_op_t;
+
 extern char *BFi_program_str;
 extern BFi_instr_t *BFi_code;
 extern size_t BFi_code_size;
 
+extern BFi_op_t *BFi_bytecode;
+extern size_t BFi_bytecode_len;
+
 extern bool BFi_do_recompile;
 extern bool BFi_is_running;
 extern char BFi_last_output;
@@ -95,7 +113,5 @@ extern void BFi_compile(bool translate);
 extern void BFi_exec();
 
 extern int (*BFi_putchar)(int ch);
-extern void (*BFi_on_fwd)(size_t op);
-extern void (*BFi_on_bck)(size_t op);
 
 #endif
\ No newline at end of file
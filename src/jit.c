@@ -0,0 +1,402 @@
+/* Bfcli: The Interactive Brainfuck Command-Line Interpreter
+ * Copyright (C) 2021-2022 Jyothiraditya Nellakra
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>. */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+
+#include "errors.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "optims.h"
+
+/* The generated code follows the register assignment of the amd64 backend,
+ * except that %rbx holds the tape index rather than a pointer so that it can
+ * be written straight back to BFi_mem_ptr:
+ *
+ *   %rbx: BFi_mem_ptr, %r12: BFi_mem, %r13: BFi_mem_size,
+ *   %r14: &BFi_is_running, %r15: the stack pointer on entry.
+ *
+ * Cells are addressed as ad(%r12, %rbx). Like run(), the code relies on the
+ * guard regions around the tape to catch out-of-range accesses. */
+
+#define BODY_SIZE 64
+#define STUB_SIZE 256
+
+typedef struct {
+	size_t pos;
+	size_t target;
+
+} patch_t;
+
+static unsigned char *code;
+static size_t code_size;
+static size_t pos;
+
+static size_t exit_pos;
+
+static void emit(const char *bytes, size_t len);
+static void emit8(unsigned char byte);
+static void emit32(int32_t num);
+static void emit64(uint64_t num);
+
+static void jump(const char *op, size_t len, size_t target);
+static void mem(int reg, ssize_t ad);
+static void block(BFi_op_t *op);
+
+bool BFj_compile(BFi_op_t *ops, size_t len,
+		 char (*inp)(), void (*out)(char ch))
+{
+	#if defined(__amd64__)
+	if(code) munmap(code, code_size);
+
+	code_size = STUB_SIZE + len * BODY_SIZE;
+
+	for(size_t i = 0; i < len; i++) switch(ops[i].opcode) {
+		case BFI_INSTR_SETB: case BFI_INSTR_ADDB:
+			code_size += ops[i].ad2 * 8;
+	}
+	code = mmap(NULL, code_size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if(code == MAP_FAILED) {
+		code = NULL;
+		return false;
+	}
+
+	size_t *offs = malloc(sizeof(size_t) * len);
+	patch_t *patches = malloc(sizeof(patch_t) * len);
+	if(!(offs && patches)) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	size_t count = 0;
+	pos = 0;
+
+	emit("\x53\x41\x54\x41\x55\x41\x56\x41\x57", 9);
+	emit("\x49\x89\xe7", 3);
+
+	emit("\x48\xb8", 2); emit64((uintptr_t) &BFi_mem);
+	emit("\x4c\x8b\x20", 3);
+	emit("\x48\xb8", 2); emit64((uintptr_t) &BFi_mem_size);
+	emit("\x4c\x8b\x28", 3);
+	emit("\x48\xb8", 2); emit64((uintptr_t) &BFi_mem_ptr);
+	emit("\x48\x8b\x18", 3);
+	emit("\x49\xbe", 2); emit64((uintptr_t) &BFi_is_running);
+
+	size_t body = pos;
+	emit("\xe9", 1); emit32(0);
+
+	exit_pos = pos;
+	emit("\x4c\x89\xfc", 3);
+	emit("\x48\xb9", 2); emit64((uintptr_t) &BFi_mem_ptr);
+	emit("\x48\x89\x19", 3);
+	emit("\x41\x5f\x41\x5e\x41\x5d\x41\x5c\x5b\xc3", 10);
+
+	int32_t rel = pos - body - 5;
+	memcpy(&code[body + 1], &rel, 4);
+
+	for(size_t i = 0; i < len; i++) {
+		BFi_op_t *op = &ops[i];
+		offs[i] = pos;
+
+		size_t skip = 0, top;
+
+		switch(op -> opcode) {
+		case BFI_INSTR_INC:
+			emit("\x41\x80", 2); mem(0, op -> ad1); emit8(op -> op1);
+			break;
+
+		case BFI_INSTR_DEC:
+			emit("\x41\x80", 2); mem(5, op -> ad1); emit8(op -> op1);
+			break;
+
+		case BFI_INSTR_FWD:
+			emit("\x48\x81\xc3", 3); emit32(op -> ad1);
+			break;
+
+		case BFI_INSTR_BCK:
+			emit("\x48\x81\xeb", 3); emit32(op -> ad1);
+			break;
+
+		case BFI_INSTR_INP:
+			emit("\x48\xb8", 2); emit64((uintptr_t) inp);
+			emit("\xff\xd0", 2);
+			emit("\x41\x88", 2); mem(0, op -> ad1);
+			goto stop;
+
+		case BFI_INSTR_OUT:
+			emit("\x41\x0f\xb6", 3); mem(7, op -> ad1);
+			emit("\x48\xb8", 2); emit64((uintptr_t) out);
+			emit("\xff\xd0", 2);
+
+		stop:	emit("\x41\x80\x3e\x00", 4);
+			jump("\x0f\x84", 2, exit_pos);
+			break;
+
+		case BFI_INSTR_JZ: case BFI_INSTR_LOOP: case BFI_INSTR_IFNZ:
+			emit("\x41\x80", 2); mem(7, op -> ad2); emit8(0);
+			emit("\x0f\x84", 2);
+			goto link;
+
+		case BFI_INSTR_JMP: case BFI_INSTR_ENDL:
+			emit("\x41\x80\x3e\x00", 4);
+			jump("\x0f\x84", 2, exit_pos);
+
+			emit("\x41\x80", 2); mem(7, op -> ad2); emit8(0);
+			emit("\x0f\x85", 2);
+
+		link:	patches[count].pos = pos;
+			patches[count++].target = i + op -> ad1 + 1;
+			emit32(0);
+			break;
+
+		case BFI_INSTR_CMPL:
+			emit("\x41\xf6", 2); mem(3, op -> ad1);
+			break;
+
+		case BFI_INSTR_MOV:
+			emit("\x41\xc6", 2); mem(0, op -> ad1); emit8(op -> op1);
+			break;
+
+		case BFI_INSTR_MULA: case BFI_INSTR_MULS: case BFI_INSTR_MULM:
+		case BFI_INSTR_SHLA: case BFI_INSTR_SHLS: case BFI_INSTR_SHLM:
+		case BFI_INSTR_CPYA: case BFI_INSTR_CPYS: case BFI_INSTR_CPYM:
+			emit("\x41\x0f\xb6", 3); mem(0, op -> ad2);
+
+			switch(op -> opcode) {
+			case BFI_INSTR_MULA: case BFI_INSTR_MULS:
+			case BFI_INSTR_MULM:
+				emit("\x69\xc0", 2); emit32(op -> op1);
+				break;
+
+			case BFI_INSTR_SHLA: case BFI_INSTR_SHLS:
+			case BFI_INSTR_SHLM:
+				emit("\xc1\xe0", 2); emit8(op -> op2);
+			}
+
+			switch(op -> opcode) {
+			case BFI_INSTR_MULM: case BFI_INSTR_SHLM:
+			case BFI_INSTR_CPYM:
+				if(!op -> ad1) break;
+
+				emit("\x84\xc0", 2);
+				emit("\x75\x0c", 2);
+				emit("\x48\x8d\x8b", 3); emit32(op -> ad1);
+				emit("\x4c\x39\xe9", 3);
+				emit("\x73", 1); skip = pos; emit8(0);
+				break;
+
+			default:
+				emit("\x84\xc0", 2);
+				emit("\x74", 1); skip = pos; emit8(0);
+			}
+
+			switch(op -> opcode) {
+			case BFI_INSTR_MULA: case BFI_INSTR_SHLA:
+			case BFI_INSTR_CPYA:
+				emit("\x41\x00", 2);
+				break;
+
+			case BFI_INSTR_MULS: case BFI_INSTR_SHLS:
+			case BFI_INSTR_CPYS:
+				emit("\x41\x28", 2);
+				break;
+
+			default:
+				emit("\x41\x88", 2);
+			}
+
+			mem(0, op -> ad1);
+			if(skip) code[skip] = pos - skip - 1;
+			break;
+
+		case BFI_INSTR_SCAN:
+			top = pos;
+			emit("\x41\x80", 2); mem(7, 0); emit8(0);
+			emit("\x74", 1); skip = pos; emit8(0);
+
+			switch(op -> ad1) {
+			case 1:
+				emit("\x49\x8d", 2); mem(7, 0);
+				emit("\x31\xf6", 2);
+				emit("\x4c\x89\xea", 3);
+				emit("\x48\x29\xda", 3);
+				emit("\x48\xb8", 2); emit64((uintptr_t) memchr);
+				emit("\xff\xd0", 2);
+				emit("\x4c\x89\xeb", 3);
+				break;
+
+			case -1:
+				emit("\x4c\x89\xe7", 3);
+				emit("\x31\xf6", 2);
+				emit("\x48\x8d\x53\x01", 4);
+				emit("\x48\xb8", 2); emit64((uintptr_t) memrchr);
+				emit("\xff\xd0", 2);
+				emit("\x48\xc7\xc3", 3); emit32(-1);
+				break;
+
+			default:
+				emit("\x48\x81\xc3", 3); emit32(op -> ad1);
+				emit("\xeb", 1); emit8(top - pos - 1);
+				goto done;
+			}
+
+			emit("\x48\x85\xc0", 3);
+			emit("\x74", 1); emit8(top - pos - 1);
+			emit("\x48\x89\xc3", 3);
+			emit("\x4c\x29\xe3", 3);
+
+		done:	code[skip] = pos - skip - 1;
+			break;
+
+		case BFI_INSTR_PRDA:
+			emit("\x41\x0f\xb6", 3); mem(0, op -> ad2);
+			emit("\x41\x0f\xb6", 3); mem(1, op -> ad3);
+			emit("\x0f\xaf\xc1", 3);
+			emit("\x84\xc0", 2);
+			emit("\x74", 1); skip = pos; emit8(0);
+
+			emit("\x69\xc0", 2); emit32(op -> op1);
+			emit("\x41\x00", 2); mem(0, op -> ad1);
+			code[skip] = pos - skip - 1;
+			break;
+
+		case BFI_INSTR_SETB: case BFI_INSTR_ADDB:
+			block(op);
+			break;
+
+		case BFI_INSTR_JSR:
+			emit("\x48\x83\xec\x08", 4);
+			emit("\xe8", 1);
+
+			patches[count].pos = pos;
+			patches[count++].target = i + op -> ad1 + 1;
+			emit32(0);
+
+			emit("\x48\x83\xc4\x08", 4);
+			break;
+
+		case BFI_INSTR_RTS:
+			emit("\xc3", 1);
+			break;
+
+		case BFI_INSTR_SUB: case BFI_INSTR_RET:
+			jump("\xe9", 1, exit_pos);
+		}
+	}
+
+	for(size_t i = 0; i < count; i++) {
+		rel = offs[patches[i].target] - patches[i].pos - 4;
+		memcpy(&code[patches[i].pos], &rel, 4);
+	}
+
+	free(offs);
+	free(patches);
+
+	if(mprotect(code, code_size, PROT_READ | PROT_EXEC) == -1) {
+		munmap(code, code_size);
+		code = NULL;
+		return false;
+	}
+
+	return true;
+
+	#else
+	(void) ops; (void) len; (void) inp; (void) out;
+	return false;
+	#endif
+}
+
+void BFj_exec() {
+	((void (*)()) code)();
+}
+
+static void emit(const char *bytes, size_t len) {
+	memcpy(&code[pos], bytes, len);
+	pos += len;
+}
+
+static void emit8(unsigned char byte) {
+	code[pos++] = byte;
+}
+
+static void emit32(int32_t num) {
+	memcpy(&code[pos], &num, 4);
+	pos += 4;
+}
+
+static void emit64(uint64_t num) {
+	memcpy(&code[pos], &num, 8);
+	pos += 8;
+}
+
+static void jump(const char *op, size_t len, size_t target) {
+	emit(op, len);
+	emit32(target - pos - 4);
+}
+
+static void mem(int reg, ssize_t ad) {
+	emit8((ad ? 0x84 : 0x04) | reg << 3);
+	emit8(0x1c);
+	if(ad) emit32(ad);
+}
+
+/* Copies or adds blocks 16, 8 and then 4 bytes at a time through xmm0 and
+ * xmm1, with rax pointing at the table entry, and handles the last few bytes
+ * one at a time. */
+
+static void block(BFi_op_t *op) {
+	static const char *loads[] = {
+		"\xf3\x0f\x6f", "\xf3\x0f\x7e", "\x66\x0f\x6e"
+	};
+
+	static const char *stores[] = {
+		"\xf3\x0f\x7f", "\x66\x0f\xd6", "\x66\x0f\x7e"
+	};
+
+	unsigned char *values = &BFo_blocks[op -> ad3];
+	size_t i = 0, len = op -> ad2;
+
+	emit("\x48\xb8", 2); emit64((uintptr_t) values);
+
+	for(size_t j = 0, size = 16; size >= 4; j++, size /= 2) {
+		for(; len - i >= size; i += size) {
+			emit(loads[j], 3); emit8(0x80); emit32(i);
+
+			if(op -> opcode == BFI_INSTR_ADDB) {
+				emit8(loads[j][0]); emit8(0x41);
+				emit(&loads[j][1], 2); mem(1, op -> ad1 + i);
+				emit("\x66\x0f\xfc\xc1", 4);
+			}
+
+			emit8(stores[j][0]); emit8(0x41);
+			emit(&stores[j][1], 2); mem(0, op -> ad1 + i);
+		}
+	}
+
+	for(; i < len; i++) {
+		if(op -> opcode == BFI_INSTR_SETB) emit("\x41\xc6", 2);
+		else if(values[i]) emit("\x41\x80", 2);
+		else continue;
+
+		mem(0, op -> ad1 + i); emit8(values[i]);
+	}
+}
@@ -70,14 +70,16 @@ int main(int argc, char **argv) {
 	static char old_file[BF_FILENAME_SIZE];
 
 	while(true) {
-		int ret = tcsetattr(STDIN_FILENO, TCSANOW, &BFc_cooked);
-		if(ret == -1) BFe_report_err(BFE_UNKNOWN_ERROR);
+		BFc_set_term(&BFc_cooked);
 
 		if(BFc_minimal_mode) printf("%% "); else BFp_print_prompt();
 		LCl_buffer = line + BFm_insertion_point;
 		LCl_length = BF_LINE_SIZE - BFm_insertion_point;
 
-		if(BFc_no_ansi) ret = LCl_bread(line, BF_LINE_SIZE);
+		int ret;
+		if(BFc_no_ansi || BFc_batch_inp)
+			ret = LCl_bread(line, BF_LINE_SIZE);
+
 		else ret = LCl_read();
 
 		switch(ret) {
@@ -118,8 +120,7 @@ int main(int argc, char **argv) {
 
 		switch(ret) {
 		case CODE_OK:
-			ret = tcsetattr(STDIN_FILENO, TCSANOW, &BFc_raw);
-			if(ret == -1) BFe_report_err(BFE_UNKNOWN_ERROR);
+			BFc_set_term(&BFc_raw);
 			
 			BFi_is_running = true;
 
@@ -228,6 +229,18 @@ static void init(int argc, char **argv) {
 	arg -> var = var;
 	arg -> value = true;
 
+	var = LCv_new();
+	if(!var) BFe_report_err(BFE_UNKNOWN_ERROR);
+	var -> id = "embed";
+	var -> data = &BFt_embed;
+
+	arg = LCa_new();
+	if(!arg) BFe_report_err(BFE_UNKNOWN_ERROR);
+	arg -> long_flag = "embed";
+	arg -> short_flag = 'e';
+	arg -> var = var;
+	arg -> value = true;
+
 	var = LCv_new();
 	if(!var) BFe_report_err(BFE_UNKNOWN_ERROR);
 	var -> id = "output";
@@ -276,6 +289,30 @@ static void init(int argc, char **argv) {
 	arg -> var = var;
 	arg -> value = true;
 
+	var = LCv_new();
+	if(!var) BFe_report_err(BFE_UNKNOWN_ERROR);
+	var -> id = "batch-inp";
+	var -> data = &BFc_batch_inp;
+
+	arg = LCa_new();
+	if(!arg) BFe_report_err(BFE_UNKNOWN_ERROR);
+	arg -> long_flag = "batch-inp";
+	arg -> short_flag = 'b';
+	arg -> var = var;
+	arg -> value = true;
+
+	var = LCv_new();
+	if(!var) BFe_report_err(BFE_UNKNOWN_ERROR);
+	var -> id = "jit";
+	var -> data = &BFc_jit;
+
+	arg = LCa_new();
+	if(!arg) BFe_report_err(BFE_UNKNOWN_ERROR);
+	arg -> long_flag = "jit";
+	arg -> short_flag = 'j';
+	arg -> var = var;
+	arg -> value = true;
+
 	var = LCv_new();
 	if(!var) BFe_report_err(BFE_UNKNOWN_ERROR);
 	var -> id = "optim";
@@ -325,6 +362,18 @@ static void init(int argc, char **argv) {
 	arg -> short_flag = 'M';
 	arg -> var = var;
 
+	var = LCv_new();
+	if(!var) BFe_report_err(BFE_UNKNOWN_ERROR);
+	var -> id = "unroll";
+	var -> fmt = "%zd";
+	var -> data = &BFo_max_unroll;
+
+	arg = LCa_new();
+	if(!arg) BFe_report_err(BFE_UNKNOWN_ERROR);
+	arg -> long_flag = "unroll";
+	arg -> short_flag = 'U';
+	arg -> var = var;
+
 	LCa_noflags = &BFc_immediate;
 	LCa_max_noflags = 1;
 
@@ -332,7 +381,7 @@ static void init(int argc, char **argv) {
 	if(ret != LCA_OK) BFp_print_minihelp();
 
 	if(BFt_standalone) BFt_compile = true;
-	if(BFt_compile) BFt_translate = true;
+	if(BFt_compile || BFt_embed) BFt_translate = true;
 
 	if(!strlen(BFa_target_arch)) {
 		#if defined(__i386__)
@@ -38,14 +38,20 @@
 char BFo_level = '0';
 ssize_t BFo_mem_padding;
 bool BFo_advanced_ops = true;
+bool BFo_zeroed_mem = true;
+bool BFo_keep_ptr = false;
 
 size_t BFo_sub_count = 1;
 size_t BFo_max_subs = SIZE_MAX;
+size_t BFo_max_unroll = 128;
 
 unsigned char *BFo_precomp_output;
 size_t BFo_precomp_cells;
 size_t BFo_precomp_ptr;
 
+unsigned char *BFo_blocks;
+size_t BFo_blocks_size;
+
 void BFo_optimise() {
 	while(BFi_code) {
 		BFi_instr_t *instr = BFi_code;
@@ -53,9 +59,20 @@ void BFo_optimise() {
 		free(instr);
 	}
 
+	free(BFo_blocks);
+	BFo_blocks = NULL;
+	BFo_blocks_size = 0;
+
 	if(!strcmp(BFa_target_arch, "z80")) BFo_advanced_ops = false;
+	BFo_sub_count = 1;
+
+	char level = BFo_level;
+	if(!BFt_translate) switch(level) {
+		case 'P': case 'p': level = '3'; break;
+		case 'A': case 'a': level = 'S'; break;
+	}
 
-	switch(BFo_level) {
+	switch(level) {
 		case '0': BFi_compile(true); break;
 		case '1': BFi_code = BFo_optimise_lv1(); break;
 		case '2': BFi_code = BFo_optimise_lv2(); break;
@@ -23,14 +23,20 @@
 extern char BFo_level;
 extern ssize_t BFo_mem_padding;
 extern bool BFo_advanced_ops;
+extern bool BFo_zeroed_mem;
+extern bool BFo_keep_ptr;
 
 extern size_t BFo_sub_count;
 extern size_t BFo_max_subs;
+extern size_t BFo_max_unroll;
 
 extern unsigned char *BFo_precomp_output;
 extern size_t BFo_precomp_cells;
 extern size_t BFo_precomp_ptr;
 
+extern unsigned char *BFo_blocks;
+extern size_t BFo_blocks_size;
+
 extern void BFo_optimise();
 
 #endif
\ No newline at end of file
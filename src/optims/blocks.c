@@ -0,0 +1,246 @@
+/* Bfcli: The Interactive Brainfuck Command-Line Interpreter
+ * Copyright (C) 2021-2022 Jyothiraditya Nellakra
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+#include "blocks.h"
+
+#include "../errors.h"
+#include "../interpreter.h"
+#include "../optims.h"
+
+/* Straight runs of INCs, DECs and MOVs only ever change cells by constants,
+ * so each cell's changes can be combined and the run rewritten in order of
+ * address whenever that saves anything. Where enough neighbouring cells are
+ * all set, or all added to, they become a single block operation:
+ *
+ *   SETB: p[ad1 + i] = BFo_blocks[op2 + i] for i < op1,
+ *   ADDB: p[ad1 + i] += BFo_blocks[op2 + i] for i < op1.
+ *
+ * Every entry in the table starts on a 16-byte boundary, so that the vector
+ * backends can use aligned loads from it. */
+
+#define MIN_BLOCK 4
+
+typedef struct {
+	ssize_t ad;
+	bool set;
+	unsigned char value;
+
+} change_t;
+
+static change_t *changes;
+static size_t change_count, change_max;
+
+static bool is_const(BFi_instr_t *instr);
+static void record(BFi_instr_t *instr);
+static size_t block_end(size_t i);
+
+static size_t store(size_t i, size_t count);
+static BFi_instr_t *emit(BFi_instr_t **start, BFi_instr_t *prev, int opcode,
+			 size_t op1, size_t op2, ssize_t ad1);
+
+BFi_instr_t *BFo_optimise_blocks(BFi_instr_t *start) {
+	BFi_instr_t *instr = start;
+
+	while(instr) {
+		if(!is_const(instr)) {
+			instr = instr -> next;
+			continue;
+		}
+
+		BFi_instr_t *first = instr;
+		size_t count = 0;
+		bool found = false;
+		change_count = 0;
+
+		for(; instr && is_const(instr); instr = instr -> next, count++)
+			record(instr);
+
+		for(size_t i = 0, end; i < change_count; i = end) {
+			end = block_end(i);
+			if(end - i >= MIN_BLOCK) found = true;
+		}
+
+		if(!found && change_count == count) continue;
+
+		BFi_instr_t *prev = first -> prev;
+
+		while(first != instr) {
+			BFi_instr_t *rip = first;
+			first = first -> next;
+			free(rip);
+		}
+
+		for(size_t i = 0, end; i < change_count;) {
+			change_t *change = &changes[i];
+			end = block_end(i);
+
+			if(end - i >= MIN_BLOCK) {
+				prev = emit(&start, prev, change -> set ?
+					BFI_INSTR_SETB : BFI_INSTR_ADDB, end - i,
+					store(i, end - i), change -> ad);
+
+				i = end;
+				continue;
+			}
+
+			for(; i < end; i++) {
+				change = &changes[i];
+
+				if(change -> set)
+					prev = emit(&start, prev, BFI_INSTR_MOV,
+						change -> value, 0, change -> ad);
+
+				else if(change -> value && change -> value < 128)
+					prev = emit(&start, prev, BFI_INSTR_INC,
+						change -> value, 0, change -> ad);
+
+				else if(change -> value)
+					prev = emit(&start, prev, BFI_INSTR_DEC,
+						256 - change -> value, 0,
+						change -> ad);
+			}
+		}
+
+		if(prev) prev -> next = instr;
+		else start = instr;
+
+		if(instr) instr -> prev = prev;
+	}
+
+	free(changes);
+	changes = NULL;
+	change_count = change_max = 0;
+
+	return start;
+}
+
+static bool is_const(BFi_instr_t *instr) {
+	switch(instr -> opcode) {
+	case BFI_INSTR_INC: case BFI_INSTR_DEC: case BFI_INSTR_MOV:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+static void record(BFi_instr_t *instr) {
+	size_t low = 0, high = change_count;
+
+	while(low < high) {
+		size_t mid = low + (high - low) / 2;
+
+		if(changes[mid].ad < instr -> ad1) low = mid + 1;
+		else high = mid;
+	}
+
+	if(low == change_count || changes[low].ad != instr -> ad1) {
+		if(change_count == change_max) {
+			change_max = change_max ? change_max * 2 : 64;
+			changes = realloc(changes, sizeof(change_t) * change_max);
+			if(!changes) BFe_report_err(BFE_UNKNOWN_ERROR);
+		}
+
+		memmove(&changes[low + 1], &changes[low],
+			sizeof(change_t) * (change_count - low));
+
+		change_count++;
+		changes[low] = (change_t) {instr -> ad1, false, 0};
+	}
+
+	change_t *change = &changes[low];
+
+	switch(instr -> opcode) {
+	case BFI_INSTR_INC:
+		change -> value += instr -> op1;
+		break;
+
+	case BFI_INSTR_DEC:
+		change -> value -= instr -> op1;
+		break;
+
+	case BFI_INSTR_MOV:
+		change -> set = true;
+		change -> value = instr -> op1;
+	}
+}
+
+/* Finds the end of the group of neighbouring cells that are changed the same
+ * way as the cell at index i. */
+
+static size_t block_end(size_t i) {
+	size_t j = i + 1;
+
+	while(j < change_count && changes[j].ad == changes[j - 1].ad + 1
+		&& changes[j].set == changes[i].set) j++;
+
+	return j;
+}
+
+/* Adds the values of count changes from index i to the table, reusing an
+ * existing entry if one starts with the same bytes. */
+
+static size_t store(size_t i, size_t count) {
+	size_t offset;
+
+	for(offset = 0; offset + count <= BFo_blocks_size; offset += 16) {
+		size_t j;
+		for(j = 0; j < count; j++)
+			if(BFo_blocks[offset + j] != changes[i + j].value) break;
+
+		if(j == count) return offset;
+	}
+
+	offset = BFo_blocks_size;
+	BFo_blocks_size += (count + 15) & ~(size_t) 15;
+
+	BFo_blocks = realloc(BFo_blocks, BFo_blocks_size);
+	if(!BFo_blocks) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	memset(&BFo_blocks[offset], 0, BFo_blocks_size - offset);
+	for(size_t j = 0; j < count; j++)
+		BFo_blocks[offset + j] = changes[i + j].value;
+
+	return offset;
+}
+
+static BFi_instr_t *emit(BFi_instr_t **start, BFi_instr_t *prev, int opcode,
+			 size_t op1, size_t op2, ssize_t ad1)
+{
+	BFi_instr_t *new = malloc(sizeof(BFi_instr_t));
+	if(!new) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	new -> prev = prev;
+	new -> next = new -> ptr = NULL;
+
+	new -> opcode = opcode;
+	new -> op1 = op1;
+	new -> op2 = op2;
+	new -> ad1 = ad1;
+	new -> ad2 = 0;
+
+	if(prev) prev -> next = new;
+	else *start = new;
+
+	return new;
+}
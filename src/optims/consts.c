@@ -0,0 +1,413 @@
+/* Bfcli: The Interactive Brainfuck Command-Line Interpreter
+ * Copyright (C) 2021-2022 Jyothiraditya Nellakra
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+#include "consts.h"
+#include "unroll.h"
+
+#include "../errors.h"
+#include "../interpreter.h"
+
+/* A forward pass that keeps track of which cells hold a known value, keyed by
+ * their distance from the pointer at the start of the program. Facts survive
+ * a loop as long as the loop leaves the pointer where it found it and does not
+ * write to the cell, and the cell under the pointer is always zero once a loop
+ * or scan ends. Anything that moves the pointer by an unknown amount throws
+ * away everything except that last fact. */
+
+typedef struct {
+	ssize_t ad;
+	bool known;
+	unsigned char value;
+
+} fact_t;
+
+static fact_t *facts;
+static size_t fact_count, fact_max;
+static bool zeroed;
+
+static bool lookup(ssize_t ad, unsigned char *value);
+static void set(ssize_t ad, unsigned char value);
+static void unset(ssize_t ad);
+static void forget();
+static size_t find(ssize_t ad);
+
+static BFi_instr_t *assign(BFi_instr_t **start, BFi_instr_t *instr,
+			   ssize_t ad, unsigned char value);
+static BFi_instr_t *add(BFi_instr_t **start, BFi_instr_t *instr,
+			ssize_t ad, unsigned char value);
+static BFi_instr_t *fold(BFi_instr_t **start, BFi_instr_t *instr,
+			 ssize_t offset);
+
+static BFi_instr_t *clobber(BFi_instr_t *open, ssize_t ad, bool *balanced);
+static BFi_instr_t *opening(BFi_instr_t *close);
+static BFi_instr_t *closing(BFi_instr_t *open);
+static BFi_instr_t *drop(BFi_instr_t **start, BFi_instr_t *instr);
+
+BFi_instr_t *BFo_optimise_consts(BFi_instr_t *start, bool zeroed_mem) {
+	BFi_instr_t *instr = start;
+	ssize_t offset = 0;
+
+	zeroed = zeroed_mem;
+	fact_count = 0;
+
+	while(instr) {
+		ssize_t ad = offset + instr -> ad1;
+		bool balanced = true;
+		unsigned char value;
+
+		switch(instr -> opcode) {
+		case BFI_INSTR_INC:
+			if(!lookup(ad, &value)) break;
+
+			instr = assign(&start, instr, ad, value + instr -> op1);
+			continue;
+
+		case BFI_INSTR_DEC:
+			if(!lookup(ad, &value)) break;
+
+			instr = assign(&start, instr, ad, value - instr -> op1);
+			continue;
+
+		case BFI_INSTR_CMPL:
+			if(!lookup(ad, &value)) break;
+
+			instr = assign(&start, instr, ad, -value);
+			continue;
+
+		case BFI_INSTR_MOV:
+			instr = assign(&start, instr, ad, instr -> op1);
+			continue;
+
+		case BFI_INSTR_INP:
+			unset(ad);
+			break;
+
+		case BFI_INSTR_OUT:
+			break;
+
+		case BFI_INSTR_FWD:
+			offset += instr -> op1;
+			break;
+
+		case BFI_INSTR_BCK:
+			offset -= instr -> op1;
+			break;
+
+		case BFI_INSTR_LOOP: case BFI_INSTR_IFNZ:
+			if(lookup(ad, &value) && !value) {
+				BFi_instr_t *close = closing(instr);
+
+				while(instr != close) instr = drop(&start, instr);
+				instr = drop(&start, instr);
+				continue;
+			}
+
+			if(instr -> opcode == BFI_INSTR_IFNZ) {
+				if(!lookup(ad, &value)) break;
+
+				drop(&start, closing(instr));
+				instr = drop(&start, instr);
+				continue;
+			}
+
+			if(lookup(ad, &value)) {
+				BFi_instr_t *next = BFo_unroll_loop(&start, instr,
+					value);
+
+				if(next != instr) { instr = next; continue; }
+			}
+
+			clobber(instr, offset, &balanced);
+			if(!balanced) forget();
+			break;
+
+		case BFI_INSTR_ENDL: case BFI_INSTR_ENDIF:
+			clobber(opening(instr), offset, &balanced);
+			if(!balanced) forget();
+
+			if(instr -> opcode == BFI_INSTR_ENDL) set(ad, 0);
+			break;
+
+		case BFI_INSTR_SCAN:
+			forget();
+			set(offset, 0);
+			break;
+
+		case BFI_INSTR_MULA: case BFI_INSTR_MULS: case BFI_INSTR_MULM:
+		case BFI_INSTR_SHLA: case BFI_INSTR_SHLS: case BFI_INSTR_SHLM:
+		case BFI_INSTR_CPYA: case BFI_INSTR_CPYS: case BFI_INSTR_CPYM:
+		case BFI_INSTR_PRDA:
+			instr = fold(&start, instr, offset);
+			continue;
+
+		default:
+			forget();
+		}
+
+		instr = instr -> next;
+	}
+
+	free(facts);
+	facts = NULL;
+	fact_count = fact_max = 0;
+
+	return start;
+}
+
+static bool lookup(ssize_t ad, unsigned char *value) {
+	size_t i = find(ad);
+
+	if(i < fact_count && facts[i].ad == ad) {
+		*value = facts[i].value;
+		return facts[i].known;
+	}
+
+	*value = 0;
+	return zeroed;
+}
+
+static void set(ssize_t ad, unsigned char value) {
+	size_t i = find(ad);
+
+	if(i == fact_count || facts[i].ad != ad) {
+		if(fact_count == fact_max) {
+			fact_max = fact_max ? fact_max * 2 : 64;
+			facts = realloc(facts, sizeof(fact_t) * fact_max);
+			if(!facts) BFe_report_err(BFE_UNKNOWN_ERROR);
+		}
+
+		memmove(&facts[i + 1], &facts[i],
+			sizeof(fact_t) * (fact_count - i));
+
+		fact_count++;
+		facts[i].ad = ad;
+	}
+
+	facts[i].known = true;
+	facts[i].value = value;
+}
+
+static void unset(ssize_t ad) {
+	size_t i = find(ad);
+
+	if(i < fact_count && facts[i].ad == ad) facts[i].known = false;
+	else if(zeroed) { set(ad, 0); facts[i].known = false; }
+}
+
+static void forget() {
+	fact_count = 0;
+	zeroed = false;
+}
+
+static size_t find(ssize_t ad) {
+	size_t low = 0, high = fact_count;
+
+	while(low < high) {
+		size_t mid = low + (high - low) / 2;
+
+		if(facts[mid].ad < ad) low = mid + 1;
+		else high = mid;
+	}
+
+	return low;
+}
+
+/* Rewrites an instruction as a MOV of a value that is now known, or drops it
+ * if the cell already held that value. */
+
+static BFi_instr_t *assign(BFi_instr_t **start, BFi_instr_t *instr,
+			   ssize_t ad, unsigned char value)
+{
+	unsigned char old;
+	if(lookup(ad, &old) && old == value) return drop(start, instr);
+
+	instr -> opcode = BFI_INSTR_MOV;
+	instr -> op1 = value;
+	instr -> op2 = 0;
+	instr -> ad2 = 0;
+
+	set(ad, value);
+	return instr -> next;
+}
+
+static BFi_instr_t *add(BFi_instr_t **start, BFi_instr_t *instr,
+			ssize_t ad, unsigned char value)
+{
+	unsigned char old;
+	if(lookup(ad, &old)) return assign(start, instr, ad, old + value);
+	if(!value) return drop(start, instr);
+
+	instr -> opcode = value < 128 ? BFI_INSTR_INC : BFI_INSTR_DEC;
+	instr -> op1 = value < 128 ? value : 256 - value;
+	instr -> op2 = 0;
+	instr -> ad2 = 0;
+
+	return instr -> next;
+}
+
+/* Multiplies with a known source become plain additions or moves, and those
+ * with a zero source do nothing at all. M forms that still end up writing a
+ * zero are left alone, since they skip cells past the end of the tape. */
+
+static BFi_instr_t *fold(BFi_instr_t **start, BFi_instr_t *instr,
+			 ssize_t offset)
+{
+	ssize_t ad = offset + instr -> ad1;
+	unsigned char src, other, k = 1, old;
+	bool known = lookup(offset + instr -> ad2, &src);
+
+	if(instr -> opcode == BFI_INSTR_PRDA) {
+		bool known2 = lookup(offset + (ssize_t) instr -> op2, &other);
+		if((known && !src) || (known2 && !other)) return drop(start, instr);
+
+		known = known && known2;
+		src *= other;
+	}
+
+	if(!known) {
+		unset(ad);
+		return instr -> next;
+	}
+
+	switch(instr -> opcode) {
+	case BFI_INSTR_MULA: case BFI_INSTR_MULS: case BFI_INSTR_MULM:
+	case BFI_INSTR_PRDA:
+		k = instr -> op1;
+		break;
+
+	case BFI_INSTR_SHLA: case BFI_INSTR_SHLS: case BFI_INSTR_SHLM:
+		k = 1 << instr -> op2;
+	}
+
+	unsigned char value = src * k;
+
+	switch(instr -> opcode) {
+	case BFI_INSTR_MULM: case BFI_INSTR_SHLM: case BFI_INSTR_CPYM:
+		if(src) return assign(start, instr, ad, value);
+		if(lookup(ad, &old) && !old) return drop(start, instr);
+
+		set(ad, 0);
+		return instr -> next;
+
+	case BFI_INSTR_MULS: case BFI_INSTR_SHLS: case BFI_INSTR_CPYS:
+		if(!src) return drop(start, instr);
+		return add(start, instr, ad, -value);
+
+	default:
+		if(!src) return drop(start, instr);
+		return add(start, instr, ad, value);
+	}
+}
+
+/* Marks every cell written between a bracket and its partner as unknown, and
+ * clears balanced if the pointer might end up somewhere else. */
+
+static BFi_instr_t *clobber(BFi_instr_t *open, ssize_t ad, bool *balanced) {
+	ssize_t offset = ad;
+
+	for(BFi_instr_t *instr = open -> next; instr; instr = instr -> next) {
+		switch(instr -> opcode) {
+		case BFI_INSTR_FWD:
+			offset += instr -> op1;
+			break;
+
+		case BFI_INSTR_BCK:
+			offset -= instr -> op1;
+			break;
+
+		case BFI_INSTR_LOOP: case BFI_INSTR_IFNZ:
+			instr = clobber(instr, offset, balanced);
+			break;
+
+		case BFI_INSTR_ENDL: case BFI_INSTR_ENDIF:
+			if(offset != ad) *balanced = false;
+			return instr;
+
+		case BFI_INSTR_OUT:
+			break;
+
+		case BFI_INSTR_INC: case BFI_INSTR_DEC:
+		case BFI_INSTR_CMPL: case BFI_INSTR_MOV:
+		case BFI_INSTR_INP:
+		case BFI_INSTR_MULA: case BFI_INSTR_MULS: case BFI_INSTR_MULM:
+		case BFI_INSTR_SHLA: case BFI_INSTR_SHLS: case BFI_INSTR_SHLM:
+		case BFI_INSTR_CPYA: case BFI_INSTR_CPYS: case BFI_INSTR_CPYM:
+		case BFI_INSTR_PRDA:
+			unset(offset + instr -> ad1);
+			break;
+
+		default:
+			*balanced = false;
+		}
+	}
+
+	return NULL;
+}
+
+static BFi_instr_t *opening(BFi_instr_t *close) {
+	size_t depth = 0;
+
+	for(BFi_instr_t *instr = close -> prev; instr; instr = instr -> prev) {
+		switch(instr -> opcode) {
+		case BFI_INSTR_ENDL: case BFI_INSTR_ENDIF:
+			depth++;
+			break;
+
+		case BFI_INSTR_LOOP: case BFI_INSTR_IFNZ:
+			if(!depth) return instr;
+			depth--;
+		}
+	}
+
+	return NULL;
+}
+
+static BFi_instr_t *closing(BFi_instr_t *open) {
+	size_t depth = 0;
+
+	for(BFi_instr_t *instr = open -> next; instr; instr = instr -> next) {
+		switch(instr -> opcode) {
+		case BFI_INSTR_LOOP: case BFI_INSTR_IFNZ:
+			depth++;
+			break;
+
+		case BFI_INSTR_ENDL: case BFI_INSTR_ENDIF:
+			if(!depth) return instr;
+			depth--;
+		}
+	}
+
+	return NULL;
+}
+
+static BFi_instr_t *drop(BFi_instr_t **start, BFi_instr_t *instr) {
+	BFi_instr_t *next = instr -> next;
+
+	if(instr -> prev) instr -> prev -> next = next;
+	else *start = next;
+
+	if(next) next -> prev = instr -> prev;
+	free(instr);
+
+	return next;
+}
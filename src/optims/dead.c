@@ -0,0 +1,381 @@
+/* Bfcli: The Interactive Brainfuck Command-Line Interpreter
+ * Copyright (C) 2021-2022 Jyothiraditya Nellakra
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+#include "dead.h"
+
+#include "../errors.h"
+#include "../interpreter.h"
+
+/* Walks the code backwards keeping track of the cells whose current value
+ * might still be read, and drops writes to any other cell. Cells are keyed by
+ * their distance from the pointer at the end of the program; when the tape is
+ * thrown away at the end, nothing is live there.
+ *
+ * Rather than iterating to a fixed point, the cells live at the bottom of a
+ * loop are taken to be those live after it plus every cell that the loop reads
+ * through an OUT, a loop test or a multiply source. Updates in place never make
+ * a cell live by themselves, so this can only overestimate. Loops that move the
+ * pointer by an unknown amount make every cell live. An INP does not end a
+ * cell's life either, since the cell keeps its old value at the end of input. */
+
+typedef struct {
+	ssize_t ad;
+	bool live;
+
+} cell_t;
+
+typedef struct {
+	cell_t *cells;
+	size_t count, max;
+
+	bool rest;
+	bool balanced;
+
+} set_t;
+
+static set_t live;
+static set_t *saved;
+static size_t saved_count, saved_max;
+
+static bool is_live(ssize_t ad);
+static void mark(set_t *set, ssize_t ad, bool value);
+static void merge(set_t *to, const set_t *from);
+static void copy(set_t *to, const set_t *from);
+static void top();
+
+static void enter(BFi_instr_t *close, ssize_t offset);
+static void leave(ssize_t ad);
+
+static BFi_instr_t *gather(BFi_instr_t *open, ssize_t ad, bool *balanced);
+static BFi_instr_t *opening(BFi_instr_t *close);
+static void drop(BFi_instr_t **start, BFi_instr_t *instr);
+
+BFi_instr_t *BFo_optimise_dead(BFi_instr_t *start, bool final) {
+	BFi_instr_t *instr = start;
+	ssize_t offset = 0;
+
+	if(!instr) return start;
+	while(instr -> next) instr = instr -> next;
+
+	live.count = 0;
+	live.rest = !final;
+
+	while(instr) {
+		BFi_instr_t *prev = instr -> prev;
+		ssize_t ad = offset + instr -> ad1;
+
+		switch(instr -> opcode) {
+		case BFI_INSTR_INC: case BFI_INSTR_DEC:
+		case BFI_INSTR_CMPL:
+			if(!is_live(ad)) drop(&start, instr);
+			break;
+
+		case BFI_INSTR_MOV:
+			if(!is_live(ad)) drop(&start, instr);
+			else mark(&live, ad, false);
+			break;
+
+		case BFI_INSTR_INP:
+			break;
+
+		case BFI_INSTR_OUT:
+			mark(&live, ad, true);
+			break;
+
+		case BFI_INSTR_FWD:
+			offset -= instr -> op1;
+			break;
+
+		case BFI_INSTR_BCK:
+			offset += instr -> op1;
+			break;
+
+		case BFI_INSTR_MULA: case BFI_INSTR_MULS:
+		case BFI_INSTR_SHLA: case BFI_INSTR_SHLS:
+		case BFI_INSTR_CPYA: case BFI_INSTR_CPYS:
+			if(!is_live(ad)) { drop(&start, instr); break; }
+
+			mark(&live, offset + instr -> ad2, true);
+			break;
+
+		case BFI_INSTR_MULM: case BFI_INSTR_SHLM: case BFI_INSTR_CPYM:
+			if(!is_live(ad)) { drop(&start, instr); break; }
+
+			mark(&live, ad, false);
+			mark(&live, offset + instr -> ad2, true);
+			break;
+
+		case BFI_INSTR_PRDA:
+			if(!is_live(ad)) { drop(&start, instr); break; }
+
+			mark(&live, offset + instr -> ad2, true);
+			mark(&live, offset + (ssize_t) instr -> op2, true);
+			break;
+
+		case BFI_INSTR_ENDL: case BFI_INSTR_ENDIF:
+			enter(instr, offset);
+			break;
+
+		case BFI_INSTR_LOOP: case BFI_INSTR_IFNZ:
+			leave(ad);
+
+			if(instr -> opcode == BFI_INSTR_IFNZ
+				&& instr -> next -> opcode == BFI_INSTR_ENDIF)
+			{
+				drop(&start, instr -> next);
+				drop(&start, instr);
+			}
+
+			break;
+
+		default:
+			top();
+		}
+
+		instr = prev;
+	}
+
+	for(size_t i = 0; i < saved_max; i++) free(saved[i].cells);
+	free(saved);
+	free(live.cells);
+
+	saved = NULL;
+	saved_count = saved_max = 0;
+	live.cells = NULL;
+	live.max = 0;
+
+	return start;
+}
+
+static bool is_live(ssize_t ad) {
+	size_t low = 0, high = live.count;
+
+	while(low < high) {
+		size_t mid = low + (high - low) / 2;
+
+		if(live.cells[mid].ad < ad) low = mid + 1;
+		else high = mid;
+	}
+
+	if(low < live.count && live.cells[low].ad == ad)
+		return live.cells[low].live;
+
+	return live.rest;
+}
+
+static void mark(set_t *set, ssize_t ad, bool value) {
+	size_t low = 0, high = set -> count;
+
+	while(low < high) {
+		size_t mid = low + (high - low) / 2;
+
+		if(set -> cells[mid].ad < ad) low = mid + 1;
+		else high = mid;
+	}
+
+	if(low == set -> count || set -> cells[low].ad != ad) {
+		if(set -> count == set -> max) {
+			set -> max = set -> max ? set -> max * 2 : 64;
+			set -> cells = realloc(set -> cells,
+				sizeof(cell_t) * set -> max);
+
+			if(!set -> cells) BFe_report_err(BFE_UNKNOWN_ERROR);
+		}
+
+		memmove(&set -> cells[low + 1], &set -> cells[low],
+			sizeof(cell_t) * (set -> count - low));
+
+		set -> count++;
+		set -> cells[low].ad = ad;
+	}
+
+	set -> cells[low].live = value;
+}
+
+static void merge(set_t *to, const set_t *from) {
+	set_t out = {NULL, 0, 0, to -> rest || from -> rest, to -> balanced};
+	size_t i = 0, j = 0;
+
+	while(i < to -> count || j < from -> count) {
+		ssize_t ad;
+		bool a = to -> rest, b = from -> rest;
+
+		if(j == from -> count || (i < to -> count
+			&& to -> cells[i].ad < from -> cells[j].ad))
+		{
+			ad = to -> cells[i].ad;
+			a = to -> cells[i++].live;
+		}
+
+		else if(i == to -> count || from -> cells[j].ad
+			< to -> cells[i].ad)
+		{
+			ad = from -> cells[j].ad;
+			b = from -> cells[j++].live;
+		}
+
+		else {
+			ad = to -> cells[i].ad;
+			a = to -> cells[i++].live;
+			b = from -> cells[j++].live;
+		}
+
+		mark(&out, ad, a || b);
+	}
+
+	free(to -> cells);
+	*to = out;
+}
+
+static void copy(set_t *to, const set_t *from) {
+	if(to -> max < from -> count) {
+		to -> max = from -> count;
+		to -> cells = realloc(to -> cells, sizeof(cell_t) * to -> max);
+		if(!to -> cells) BFe_report_err(BFE_UNKNOWN_ERROR);
+	}
+
+	if(from -> count)
+		memcpy(to -> cells, from -> cells, sizeof(cell_t) * from -> count);
+
+	to -> count = from -> count;
+	to -> rest = from -> rest;
+	to -> balanced = from -> balanced;
+}
+
+static void top() {
+	live.count = 0;
+	live.rest = true;
+}
+
+/* On the way into a loop or IFNZ from the bottom, the cells live after it are
+ * saved so that they can be added back at the top, where it may be skipped.
+ * An IFNZ only runs once, but its reads are added all the same. */
+
+static void enter(BFi_instr_t *close, ssize_t offset) {
+	BFi_instr_t *open = opening(close);
+	bool balanced = true;
+
+	gather(open, offset, &balanced);
+	if(!balanced) top();
+
+	if(saved_count == saved_max) {
+		saved_max = saved_max ? saved_max * 2 : 16;
+		saved = realloc(saved, sizeof(set_t) * saved_max);
+		if(!saved) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+		memset(&saved[saved_count], 0,
+			sizeof(set_t) * (saved_max - saved_count));
+	}
+
+	copy(&saved[saved_count], &live);
+	saved[saved_count++].balanced = balanced;
+}
+
+static void leave(ssize_t ad) {
+	set_t *after = &saved[--saved_count];
+
+	if(after -> balanced) merge(&live, after);
+	else top();
+
+	mark(&live, ad, true);
+}
+
+/* Marks every cell that the code between a bracket and its partner reads for
+ * anything other than an update in place. */
+
+static BFi_instr_t *gather(BFi_instr_t *open, ssize_t ad, bool *balanced) {
+	ssize_t offset = ad;
+
+	for(BFi_instr_t *instr = open -> next; instr; instr = instr -> next) {
+		switch(instr -> opcode) {
+		case BFI_INSTR_FWD:
+			offset += instr -> op1;
+			break;
+
+		case BFI_INSTR_BCK:
+			offset -= instr -> op1;
+			break;
+
+		case BFI_INSTR_LOOP: case BFI_INSTR_IFNZ:
+			mark(&live, offset + instr -> ad1, true);
+			instr = gather(instr, offset, balanced);
+			break;
+
+		case BFI_INSTR_ENDL: case BFI_INSTR_ENDIF:
+			mark(&live, offset + instr -> ad1, true);
+			if(offset != ad) *balanced = false;
+			return instr;
+
+		case BFI_INSTR_OUT:
+			mark(&live, offset + instr -> ad1, true);
+			break;
+
+		case BFI_INSTR_MULA: case BFI_INSTR_MULS: case BFI_INSTR_MULM:
+		case BFI_INSTR_SHLA: case BFI_INSTR_SHLS: case BFI_INSTR_SHLM:
+		case BFI_INSTR_CPYA: case BFI_INSTR_CPYS: case BFI_INSTR_CPYM:
+			mark(&live, offset + instr -> ad2, true);
+			break;
+
+		case BFI_INSTR_PRDA:
+			mark(&live, offset + instr -> ad2, true);
+			mark(&live, offset + (ssize_t) instr -> op2, true);
+			break;
+
+		case BFI_INSTR_INC: case BFI_INSTR_DEC:
+		case BFI_INSTR_CMPL: case BFI_INSTR_MOV:
+		case BFI_INSTR_INP:
+			break;
+
+		default:
+			*balanced = false;
+		}
+	}
+
+	return NULL;
+}
+
+static BFi_instr_t *opening(BFi_instr_t *close) {
+	size_t depth = 0;
+
+	for(BFi_instr_t *instr = close -> prev; instr; instr = instr -> prev) {
+		switch(instr -> opcode) {
+		case BFI_INSTR_ENDL: case BFI_INSTR_ENDIF:
+			depth++;
+			break;
+
+		case BFI_INSTR_LOOP: case BFI_INSTR_IFNZ:
+			if(!depth) return instr;
+			depth--;
+		}
+	}
+
+	return NULL;
+}
+
+static void drop(BFi_instr_t **start, BFi_instr_t *instr) {
+	if(instr -> prev) instr -> prev -> next = instr -> next;
+	else *start = instr -> next;
+
+	if(instr -> next) instr -> next -> prev = instr -> prev;
+	free(instr);
+}
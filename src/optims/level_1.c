@@ -14,6 +14,7 @@
  * You should have received a copy of the GNU General Public License along with
  * this program. If not, see <https://www.gnu.org/licenses/>. */
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
 
@@ -27,8 +28,15 @@
 
 static void delete(BFi_instr_t *node, ssize_t offset);
 static void insert(BFi_instr_t *node, ssize_t offset);
+static void finish(BFi_instr_t *last, ssize_t offset, bool pending);
+static BFi_instr_t *balanced(BFi_instr_t *open);
+
+/* Loops that always leave the pointer where they found it carry the offset
+ * straight through, with the cell they test kept in ad1, so the pointer only
+ * has to be moved at the edges of the loops that do not. */
 
 BFi_instr_t *BFo_optimise_lv1() {
+	BFi_instr_t *end = NULL, *last = NULL;
 	bool call_delete = false;
 	ssize_t offset = 0;
 
@@ -36,8 +44,13 @@ BFi_instr_t *BFo_optimise_lv1() {
 	if(!BFo_advanced_ops) return BFi_code;
 
 	for(BFi_instr_t *instr = BFi_code; instr; instr = instr -> next) {
+		last = instr;
+
+		if(!end && instr -> opcode == BFI_INSTR_LOOP)
+			end = balanced(instr);
+
 		if(call_delete) {
-			delete(instr -> prev, offset);
+			delete(instr -> prev, end ? 0 : offset);
 			call_delete = false;
 		}
 
@@ -70,11 +83,17 @@ BFi_instr_t *BFo_optimise_lv1() {
 			break;
 
 		case BFI_INSTR_LOOP: case BFI_INSTR_ENDL:
-			insert(instr -> prev, offset);
-			offset = 0;
+			if(end) instr -> ad1 = offset;
+			else {
+				insert(instr -> prev, offset);
+				offset = 0;
+			}
+
+			if(instr == end) end = NULL;
 		}
 	}
 
+	if(BFo_keep_ptr) finish(last, offset, call_delete);
 	return BFi_code;
 }
 
@@ -129,4 +148,64 @@ static void insert(BFi_instr_t *node, ssize_t offset) {
 		new -> ad1 = 0;
 		new -> ad2 = 0;
 	}
-}
\ No newline at end of file
+}
+
+/* The REPL keeps the pointer between commands, so the offset left over at
+ * the end of the program has to be moved by after all. */
+
+static void finish(BFi_instr_t *last, ssize_t offset, bool pending) {
+	if(!last) return;
+
+	if(pending && !offset) {
+		if(last == BFi_code) BFi_code = NULL;
+		if(last -> prev) last -> prev -> next = NULL;
+		free(last);
+		return;
+	}
+
+	if(!pending) {
+		if(!offset) return;
+
+		BFi_instr_t *new = malloc(sizeof(BFi_instr_t));
+		if(!new) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+		new -> next = NULL;
+		new -> prev = last;
+		last -> next = new;
+
+		new -> ptr = NULL;
+		new -> op2 = 0;
+		new -> ad1 = 0;
+		new -> ad2 = 0;
+		last = new;
+	}
+
+	last -> opcode = offset > 0 ? BFI_INSTR_FWD : BFI_INSTR_BCK;
+	last -> op1 = offset > 0 ? offset : -offset;
+}
+
+static BFi_instr_t *balanced(BFi_instr_t *open) {
+	ssize_t offset = 0;
+
+	for(BFi_instr_t *instr = open -> next; instr; instr = instr -> next) {
+		switch(instr -> opcode) {
+		case BFI_INSTR_FWD:
+			offset += instr -> op1;
+			break;
+
+		case BFI_INSTR_BCK:
+			offset -= instr -> op1;
+			break;
+
+		case BFI_INSTR_LOOP:
+			instr = balanced(instr);
+			if(!instr) return NULL;
+			break;
+
+		case BFI_INSTR_ENDL:
+			return offset ? NULL : instr;
+		}
+	}
+
+	return NULL;
+}
@@ -15,6 +15,7 @@
  * this program. If not, see <https://www.gnu.org/licenses/>. */
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include <sys/types.h>
@@ -34,6 +35,8 @@ static size_t log_b2(size_t val) {
 	return count - 1;
 }
 
+static bool conv_scan(BFi_instr_t *start);
+static void scale(BFi_instr_t *start, BFi_instr_t *end, size_t step);
 static void conv_loop(BFi_instr_t *start, BFi_instr_t *end, bool compl);
 static BFi_instr_t *conv_instr(BFi_instr_t *start, BFi_instr_t *end,
 			       BFi_instr_t *instr);
@@ -44,6 +47,7 @@ BFi_instr_t *BFo_optimise_lv2() {
 
 	BFi_instr_t *init = NULL;
 	size_t per_cycle = 0;
+	ssize_t test = 0;
 
 	for(BFi_instr_t *i = start; i; i = i -> next) {
 		size_t op1 = i -> op1;
@@ -51,11 +55,11 @@ BFi_instr_t *BFo_optimise_lv2() {
 
 		switch(i -> opcode) {
 		case BFI_INSTR_INC:
-			if(!ad1) per_cycle += op1;
+			if(ad1 == test) per_cycle += op1;
 			break;
 
 		case BFI_INSTR_DEC:
-			if(!ad1) per_cycle -= op1;
+			if(ad1 == test) per_cycle -= op1;
 			break;
 
 		case BFI_INSTR_FWD:
@@ -66,13 +70,16 @@ BFi_instr_t *BFo_optimise_lv2() {
 
 		case BFI_INSTR_LOOP:
 			per_cycle = 0;
-			init = i;
+			test = ad1;
+			init = conv_scan(i) ? NULL : i;
 			break;
 
 		case BFI_INSTR_ENDL:
-			if(init) switch(per_cycle) {
-				case 1: conv_loop(init, i, true); break;
-				case -1: conv_loop(init, i, false);
+			if(init && per_cycle % 256 == 1) conv_loop(init, i, true);
+
+			else if(init && per_cycle % 2) {
+				scale(init, i, per_cycle % 256);
+				conv_loop(init, i, false);
 			}
 
 			init = NULL;
@@ -83,7 +90,7 @@ BFi_instr_t *BFo_optimise_lv2() {
 	for(BFi_instr_t *i = start; i; i = i -> next) {
 		switch(i -> opcode) {
 		case BFI_INSTR_MOV:
-			if(i -> next -> ad1) continue;
+			if(i -> next -> ad1 != i -> ad1) continue;
 
 			switch(i -> next -> opcode) {
 			case BFI_INSTR_INC:
@@ -109,18 +116,72 @@ BFi_instr_t *BFo_optimise_lv2() {
 	return start;
 }
 
+/* Turns [>], [<<<] and the like into a single SCAN, with the signed stride
+ * in ad1 and the loop's label kept in op1 for the assembly backends. */
+
+static bool conv_scan(BFi_instr_t *start) {
+	BFi_instr_t *move = start -> next;
+	BFi_instr_t *end = move -> next;
+
+	if(!end || end -> opcode != BFI_INSTR_ENDL) return false;
+	if(move -> op1 > INT32_MAX) return false;
+
+	switch(move -> opcode) {
+	case BFI_INSTR_FWD:
+		start -> ad1 = move -> op1;
+		break;
+
+	case BFI_INSTR_BCK:
+		start -> ad1 = -(ssize_t) move -> op1;
+		break;
+
+	default:
+		return false;
+	}
+
+	start -> opcode = BFI_INSTR_SCAN;
+	start -> next = end -> next;
+	if(end -> next) end -> next -> prev = start;
+
+	free(move);
+	free(end);
+	return true;
+}
+
+/* A loop that changes its counter by an odd step runs x * m times mod 256,
+ * where m is minus the inverse of the step, so the body's changes can be
+ * multiplied by m to get a loop that counts down by one. Even steps are left
+ * alone, since whether they ever finish depends on the counter's value. */
+
+static void scale(BFi_instr_t *start, BFi_instr_t *end, size_t step) {
+	size_t inverse = step;
+	for(int i = 0; i < 3; i++) inverse = inverse * (2 - step * inverse) % 256;
+
+	size_t factor = (256 - inverse) % 256;
+
+	for(BFi_instr_t *i = start -> next; i != end; i = i -> next) {
+		if(i -> ad1 == start -> ad1) continue;
+
+		i -> op1 = i -> op1 * factor % 256;
+		if(!i -> op1) i -> ad1 = start -> ad1;
+	}
+}
+
 static void conv_loop(BFi_instr_t *start, BFi_instr_t *end, bool compl) {
 	BFi_instr_t *new = malloc(sizeof(BFi_instr_t));
 	if(!new) BFe_report_err(BFE_UNKNOWN_ERROR);
 
 	BFi_instr_t *start_new = new;
-	new -> op1 = 0; new -> op2 = 0;
+	new -> prev = new -> next = new -> ptr = NULL;
+	new -> op1 = new -> op2 = 0;
+	new -> ad1 = start -> ad1;
+	new -> ad2 = 0;
 
 	if(compl) new -> opcode = BFI_INSTR_CMPL;
 	else new -> opcode = BFI_INSTR_NOP;
 
 	for(BFi_instr_t *i = start -> next; i != end; i = i -> next)
-		if(i -> ad1) new = conv_instr(start_new, new, i);
+		if(i -> ad1 != start -> ad1) new = conv_instr(start_new, new, i);
 
 	for(BFi_instr_t *i = start -> next; i != end;) {
 		BFi_instr_t *instr = i;
@@ -134,7 +195,8 @@ static void conv_loop(BFi_instr_t *start, BFi_instr_t *end, bool compl) {
 
 		start -> opcode = BFI_INSTR_NOP;
 		end -> opcode = BFI_INSTR_MOV;
-		end -> ad1 = end -> ad2 = end -> op1 = 0;
+		end -> ad1 = start -> ad1;
+		end -> ad2 = end -> op1 = 0;
 
 		free(new);
 		return;
@@ -149,9 +211,13 @@ static void conv_loop(BFi_instr_t *start, BFi_instr_t *end, bool compl) {
 	start -> opcode = BFI_INSTR_IFNZ;
 	new -> opcode = BFI_INSTR_ENDIF;
 	new -> op1 = end -> op1;
+	new -> op2 = new -> ad2 = 0;
+	new -> ad1 = start -> ad1;
+	new -> ptr = NULL;
 
 	end -> opcode = BFI_INSTR_MOV;
-	end -> op1 = end -> ad2 = end -> ad1 = 0;
+	end -> op1 = end -> ad2 = 0;
+	end -> ad1 = start -> ad1;
 
 	start -> next = start_new;
 	end -> prev = new;
@@ -165,7 +231,7 @@ static BFi_instr_t *conv_instr(BFi_instr_t *start, BFi_instr_t *end,
 {
 	size_t op = instr -> op1;
 	ssize_t ad1 = instr -> ad1;
-	ssize_t ad2 = instr -> ad2;
+	ssize_t ad2 = start -> ad1;
 
 	int opcode = BFI_INSTR_NOP;
 	size_t op1 = 0, op2 = 0;
@@ -212,6 +278,7 @@ static BFi_instr_t *conv_instr(BFi_instr_t *start, BFi_instr_t *end,
 	if(!new) BFe_report_err(BFE_UNKNOWN_ERROR);
 
 	new -> prev = i; new -> next = i -> next;
+	new -> ptr = NULL;
 	new -> ad1 = ad1; new -> ad2 = ad2;
 	new -> op1 = op1; new -> op2 = op2;
 	new -> opcode = opcode;
@@ -17,9 +17,14 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "blocks.h"
+#include "consts.h"
+#include "dead.h"
 #include "level_2.h"
 #include "level_3.h"
+#include "nested.h"
 
 #include "../interpreter.h"
 #include "../errors.h"
@@ -27,9 +32,18 @@
 
 static void delete(BFi_instr_t *node, ssize_t offset);
 static void insert(BFi_instr_t *node, ssize_t offset);
+static void finish(BFi_instr_t *last, ssize_t offset, bool pending);
+static BFi_instr_t *balanced(BFi_instr_t *open);
 
 static bool evaluate(BFi_instr_t *start, ssize_t ad);
 
+static bool is_written(ssize_t ad);
+static bool first_write(ssize_t ad);
+static BFi_instr_t *drop(BFi_instr_t **start, BFi_instr_t *instr);
+
+static unsigned char *written;
+static size_t written_size;
+
 BFi_instr_t *BFo_optimise_lv3() {
 	BFi_instr_t *start = BFo_optimise_lv2();
 	BFi_instr_t *instr = start;
@@ -59,32 +73,39 @@ BFi_instr_t *BFo_optimise_lv3() {
 		instr = instr -> next;
 	}
 
-	instr = start;
+	instr = BFi_code = start;
 
+	BFi_instr_t *end = NULL, *last = NULL;
 	bool call_delete = false;
 	ssize_t offset = 0;
 
 	for(; instr; instr = instr -> next) {
+		last = instr;
+
+		if(!end && instr -> opcode == BFI_INSTR_LOOP)
+			end = balanced(instr);
+
 		if(call_delete) {
-			delete(instr -> prev, offset);
+			delete(instr -> prev, end ? 0 : offset);
 			call_delete = false;
 		}
 
 		switch(instr -> opcode) {
 		case BFI_INSTR_INC: case BFI_INSTR_DEC:
 		case BFI_INSTR_INP: case BFI_INSTR_OUT:
+		case BFI_INSTR_CMPL:
 			instr -> ad1 += offset;
 			break;
 
 		case BFI_INSTR_MOV:
-			instr -> ad1 = offset;
+			instr -> ad1 += offset;
 			break;
 
 		case BFI_INSTR_MULA: case BFI_INSTR_MULS:
 		case BFI_INSTR_SHLA: case BFI_INSTR_SHLS:
 		case BFI_INSTR_CPYA: case BFI_INSTR_CPYS:
 			instr -> ad1 += offset;
-			instr -> ad2 = offset;
+			instr -> ad2 += offset;
 			break;
 
 		case BFI_INSTR_FWD:
@@ -97,11 +118,22 @@ BFi_instr_t *BFo_optimise_lv3() {
 			break;
 
 		case BFI_INSTR_LOOP: case BFI_INSTR_ENDL:
+			if(end) {
+				instr -> ad1 += offset;
+				if(instr == end) end = NULL;
+				break;
+			}
+
+			/* fall through */
+
+		case BFI_INSTR_SCAN:
 			insert(instr -> prev, offset);
 			offset = 0;
 		}
 	}
 
+	if(BFo_keep_ptr) finish(last, offset, call_delete);
+	start = BFi_code;
 	for(BFi_instr_t *instr = start; instr; instr = instr -> next) {
 	loop:	if(instr -> opcode == BFI_INSTR_MOV && !instr -> op1)
 			if(evaluate(instr, instr -> ad1))
@@ -120,111 +152,105 @@ BFi_instr_t *BFo_optimise_lv3() {
 		}
 	}
 
+	BFo_optimise_nested(start);
 	return start;
 }
 
+/* With a zeroed tape, the first write to each cell before the first loop can
+ * drop its dependency on the old value. Cells are tracked in a bitset that
+ * only grows as far as the highest cell actually touched. */
+
 BFi_instr_t *BFo_optimise_lv3_2() {
 	BFi_instr_t *start = BFo_optimise_lv3();
+	if(!BFo_advanced_ops) return start;
 
-	for(size_t i = 0; i < BFi_mem_size; i++) {
-		ssize_t ad = i;
-
-		for(BFi_instr_t *instr = start; instr; instr = instr -> next) {
-		l3:	switch(instr -> opcode) {
-			case BFI_INSTR_INC:
-				if(instr -> ad1 != ad) break;
-				instr -> opcode = BFI_INSTR_MOV;
-				goto l2;
-
-			case BFI_INSTR_DEC:
-				if(instr -> ad1 != ad) break;
-
-				instr -> opcode = BFI_INSTR_MOV;
-				instr -> op1 = 256 - instr -> op1;
-				goto l2;
-
-			case BFI_INSTR_CMPL:
-				if(instr -> ad1 != ad) break;
-				
-				if(instr -> prev)
-					instr -> prev -> next = instr -> next;
+	if(!BFo_zeroed_mem) {
+		start = BFo_optimise_consts(start, false);
+		start = BFo_optimise_dead(start, false);
+		return BFo_optimise_blocks(start);
+	}
 
-				if(instr -> next)
-					instr -> next -> prev = instr -> prev;
+	BFi_instr_t *instr = start;
+	ssize_t offset = 0;
 
-				BFi_instr_t *rip = instr;
-				instr = instr -> next;
-				free(rip);
+	while(instr) {
+		ssize_t ad = offset + instr -> ad1;
 
-				if(instr) goto l3;
-				else break;
+		switch(instr -> opcode) {
+		case BFI_INSTR_INC:
+			if(first_write(ad)) instr -> opcode = BFI_INSTR_MOV;
+			break;
 
-			case BFI_INSTR_MOV:
-				if(instr -> ad1 == ad) goto l2;
-				else break;
+		case BFI_INSTR_DEC:
+			if(!first_write(ad)) break;
 
-			case BFI_INSTR_FWD:
-				ad += instr -> op1;
-				break;
+			instr -> opcode = BFI_INSTR_MOV;
+			instr -> op1 = 256 - instr -> op1;
+			break;
 
-			case BFI_INSTR_BCK:
-				ad -= instr -> op1;
-				break;
+		case BFI_INSTR_CMPL:
+			if(is_written(ad)) break;
 
-			case BFI_INSTR_INP:
-				if(instr -> ad1 == ad) goto l2;
-				else break;
+			instr = drop(&start, instr);
+			continue;
 
-			case BFI_INSTR_LOOP: case BFI_INSTR_ENDL:
-				goto l2;
+		case BFI_INSTR_MOV: case BFI_INSTR_INP:
+			first_write(ad);
+			break;
 
-			default:
-				if(instr -> ad2 == ad) {
-					if(instr -> prev)
-						instr -> prev -> next
-						= instr -> next;
+		case BFI_INSTR_OUT:
+			break;
 
-					if(instr -> next)
-						instr -> next -> prev
-						= instr -> prev;
+		case BFI_INSTR_FWD:
+			offset += instr -> op1;
+			break;
 
-					BFi_instr_t *rip = instr;
-					instr = instr -> next;
-					free(rip);
+		case BFI_INSTR_BCK:
+			offset -= instr -> op1;
+			break;
 
-					if(instr) goto l3;
-					else break;
-				}
+		case BFI_INSTR_LOOP: case BFI_INSTR_ENDL:
+		case BFI_INSTR_IFNZ: case BFI_INSTR_ENDIF:
+		case BFI_INSTR_SCAN:
+			goto end;
 
-				if(instr -> ad1 != ad) break;
+		default:
+			if(!is_written(offset + instr -> ad2)) {
+				instr = drop(&start, instr);
+				continue;
+			}
 
-				switch(instr -> opcode) {
-				case BFI_INSTR_MULA:
-					instr -> opcode = BFI_INSTR_MULM;
-					break;
+			if(!first_write(ad)) break;
 
-				case BFI_INSTR_SHLA:
-					instr -> opcode = BFI_INSTR_SHLM;
-					break;
+			switch(instr -> opcode) {
+			case BFI_INSTR_MULA:
+				instr -> opcode = BFI_INSTR_MULM;
+				break;
 
-				case BFI_INSTR_CPYA:
-					instr -> opcode = BFI_INSTR_CPYM;
-				}
+			case BFI_INSTR_SHLA:
+				instr -> opcode = BFI_INSTR_SHLM;
+				break;
 
-				goto l2;
+			case BFI_INSTR_CPYA:
+				instr -> opcode = BFI_INSTR_CPYM;
 			}
-
 		}
 
-	l2: continue;
+		instr = instr -> next;
 	}
 
-	return start;
+end:	free(written);
+	written = NULL;
+	written_size = 0;
+
+	start = BFo_optimise_consts(start, true);
+	start = BFo_optimise_dead(start, true);
+	return BFo_optimise_blocks(start);
 }
 
 static void delete(BFi_instr_t *node, ssize_t offset) {
 	switch(node -> next -> opcode) {
-	case BFI_INSTR_LOOP: case BFI_INSTR_ENDL:
+	case BFI_INSTR_LOOP: case BFI_INSTR_ENDL: case BFI_INSTR_SCAN:
 		if(offset > 0) {
 			node -> opcode = BFI_INSTR_FWD;
 			node -> op1 = offset;
@@ -275,6 +301,66 @@ static void insert(BFi_instr_t *node, ssize_t offset) {
 	}
 }
 
+static void finish(BFi_instr_t *last, ssize_t offset, bool pending) {
+	if(!last) return;
+
+	if(pending && !offset) {
+		if(last == BFi_code) BFi_code = NULL;
+		if(last -> prev) last -> prev -> next = NULL;
+		free(last);
+		return;
+	}
+
+	if(!pending) {
+		if(!offset) return;
+
+		BFi_instr_t *new = malloc(sizeof(BFi_instr_t));
+		if(!new) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+		new -> next = NULL;
+		new -> prev = last;
+		last -> next = new;
+
+		new -> ptr = NULL;
+		new -> op2 = 0;
+		new -> ad1 = 0;
+		new -> ad2 = 0;
+		last = new;
+	}
+
+	last -> opcode = offset > 0 ? BFI_INSTR_FWD : BFI_INSTR_BCK;
+	last -> op1 = offset > 0 ? offset : -offset;
+}
+
+static BFi_instr_t *balanced(BFi_instr_t *open) {
+	ssize_t offset = 0;
+
+	for(BFi_instr_t *instr = open -> next; instr; instr = instr -> next) {
+		switch(instr -> opcode) {
+		case BFI_INSTR_FWD:
+			offset += instr -> op1;
+			break;
+
+		case BFI_INSTR_BCK:
+			offset -= instr -> op1;
+			break;
+
+		case BFI_INSTR_LOOP:
+			instr = balanced(instr);
+			if(!instr) return NULL;
+			break;
+
+		case BFI_INSTR_ENDL:
+			return offset ? NULL : instr;
+
+		case BFI_INSTR_SCAN:
+			return NULL;
+		}
+	}
+
+	return NULL;
+}
+
 static bool evaluate(BFi_instr_t *start, ssize_t ad) {
 	bool ret = true;
 
@@ -326,6 +412,7 @@ static bool evaluate(BFi_instr_t *start, ssize_t ad) {
 			else break;
 
 		case BFI_INSTR_LOOP: case BFI_INSTR_ENDL:
+		case BFI_INSTR_SCAN:
 			return false;
 
 		default:
@@ -357,11 +444,50 @@ static bool evaluate(BFi_instr_t *start, ssize_t ad) {
 
 			case BFI_INSTR_CPYA:
 				instr -> opcode = BFI_INSTR_CPYM;
+				break;
+
+			default:
+				return false;
 			}
 
 			return ret;
 		}
 	}
 
-	return ret;
-}
\ No newline at end of file
+	return ret && BFo_zeroed_mem;
+}
+
+static bool is_written(ssize_t ad) {
+	if(ad < 0 || (size_t) ad >= BFi_mem_size) return true;
+	if((size_t) ad / 8 >= written_size) return false;
+	return written[ad / 8] & 1 << ad % 8;
+}
+
+static bool first_write(ssize_t ad) {
+	if(is_written(ad)) return false;
+
+	if((size_t) ad / 8 >= written_size) {
+		size_t size = written_size ? written_size * 2 : 64;
+		while(size <= (size_t) ad / 8) size *= 2;
+
+		written = realloc(written, size);
+		if(!written) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+		memset(&written[written_size], 0, size - written_size);
+		written_size = size;
+	}
+
+	written[ad / 8] |= 1 << ad % 8;
+	return true;
+}
+
+static BFi_instr_t *drop(BFi_instr_t **start, BFi_instr_t *instr) {
+	BFi_instr_t *next = instr -> next;
+
+	if(instr -> prev) instr -> prev -> next = next;
+	else *start = next;
+
+	if(next) next -> prev = instr -> prev;
+	free(instr);
+	return next;
+}
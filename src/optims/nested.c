@@ -0,0 +1,401 @@
+/* Bfcli: The Interactive Brainfuck Command-Line Interpreter
+ * Copyright (C) 2021-2022 Jyothiraditya Nellakra
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+#include "nested.h"
+
+#include "../errors.h"
+#include "../interpreter.h"
+
+/* Once level 2 has turned inner loops into multiplies, the loop around them
+ * is often left with a straight-line body, as in [>[>+>+<<-]>>[<<+>>-]<<<-].
+ * Running that body once on symbolic cell values gives an affine map from
+ * the old values to the new ones. If the counter moves by an odd step, cells
+ * that the body overwrites settle after the first iteration, and the rest
+ * only gain a fixed amount per iteration, the loop is replaced by its result
+ * after n iterations, which needs products of the counter with other cells:
+ *
+ *   PRDA: p[ad1] += op1 * p[ad2] * p[op2], with op2 holding a signed offset.
+ *
+ * The whole thing is wrapped in an IFNZ, since none of it applies when the
+ * loop is skipped. */
+
+#define MAX_CELLS 32
+#define IS_2_POW(X) !(X & (X - 1))
+
+typedef struct {
+	unsigned char coef[MAX_CELLS];
+	unsigned char value;
+
+} affine_t;
+
+static ssize_t cells[MAX_CELLS];
+static size_t cell_count;
+
+static affine_t state[MAX_CELLS];
+static affine_t steady[MAX_CELLS];
+static affine_t result[MAX_CELLS];
+static affine_t product[MAX_CELLS];
+
+static bool modified[MAX_CELLS];
+static bool reset[MAX_CELLS];
+static bool changing[MAX_CELLS];
+
+static void flatten(BFi_instr_t *start, BFi_instr_t *end);
+static bool summarise(size_t *order, size_t *count);
+static bool run(BFi_instr_t *start, BFi_instr_t *end);
+
+static size_t find_cell(ssize_t ad);
+static bool is_identity(const affine_t *expr, size_t cell);
+static void add_scaled(affine_t *to, const affine_t *from, unsigned char k);
+static void substitute(affine_t *expr, const bool *which);
+static bool reads(size_t j, size_t k);
+
+static BFi_instr_t *emit(BFi_instr_t *prev, int opcode, size_t op1,
+			 size_t op2, ssize_t ad1, ssize_t ad2);
+static BFi_instr_t *emit_term(BFi_instr_t *prev, ssize_t ad1, ssize_t ad2,
+			      unsigned char k);
+
+void BFo_optimise_nested(BFi_instr_t *start) {
+	BFi_instr_t *loop = NULL;
+
+	for(BFi_instr_t *instr = start; instr; instr = instr -> next) {
+		switch(instr -> opcode) {
+		case BFI_INSTR_LOOP:
+			loop = instr;
+			break;
+
+		case BFI_INSTR_ENDL:
+			if(loop) flatten(loop, instr);
+			loop = NULL;
+			break;
+
+		case BFI_INSTR_INC: case BFI_INSTR_DEC:
+		case BFI_INSTR_CMPL: case BFI_INSTR_MOV:
+		case BFI_INSTR_MULA: case BFI_INSTR_MULS: case BFI_INSTR_MULM:
+		case BFI_INSTR_SHLA: case BFI_INSTR_SHLS: case BFI_INSTR_SHLM:
+		case BFI_INSTR_CPYA: case BFI_INSTR_CPYS: case BFI_INSTR_CPYM:
+			break;
+
+		default:
+			loop = NULL;
+		}
+	}
+}
+
+static void flatten(BFi_instr_t *start, BFi_instr_t *end) {
+	size_t order[MAX_CELLS], count;
+
+	if(!run(start, end)) return;
+	if(!summarise(order, &count)) return;
+
+	for(BFi_instr_t *i = start -> next; i != end;) {
+		BFi_instr_t *instr = i;
+		i = instr -> next;
+		free(instr);
+	}
+
+	start -> opcode = BFI_INSTR_IFNZ;
+	end -> opcode = BFI_INSTR_ENDIF;
+	start -> next = end;
+	end -> prev = start;
+
+	BFi_instr_t *prev = start;
+
+	for(size_t n = 0; n < count; n++) {
+		size_t j = order[n];
+		affine_t *expr = &result[j];
+
+		if(!expr -> coef[j])
+			prev = emit(prev, BFI_INSTR_MOV, expr -> value, 0,
+				cells[j], 0);
+
+		else if(expr -> value && expr -> value < 128)
+			prev = emit(prev, BFI_INSTR_INC, expr -> value, 0,
+				cells[j], 0);
+
+		else if(expr -> value)
+			prev = emit(prev, BFI_INSTR_DEC, 256 - expr -> value, 0,
+				cells[j], 0);
+
+		for(size_t k = 0; k < cell_count; k++) {
+			if(k == j || !expr -> coef[k]) continue;
+			prev = emit_term(prev, cells[j], cells[k], expr -> coef[k]);
+		}
+
+		for(size_t k = 0; k < cell_count; k++) {
+			if(!product[j].coef[k]) continue;
+
+			prev = emit(prev, BFI_INSTR_PRDA, product[j].coef[k],
+				(size_t) cells[k], cells[j], cells[0]);
+		}
+	}
+}
+
+/* Works out the loop's overall effect from the map for one iteration, and
+ * an order for the updates in which no cell is read after it has changed. */
+
+static bool summarise(size_t *order, size_t *count) {
+	affine_t *counter = &state[0];
+	if(counter -> coef[0] != 1 || !(counter -> value % 2)) return false;
+
+	for(size_t k = 1; k < cell_count; k++)
+		if(counter -> coef[k]) return false;
+
+	unsigned char step = counter -> value, inverse = step;
+	for(int i = 0; i < 3; i++) inverse *= 2 - step * inverse;
+	unsigned char times = -inverse;
+
+	for(size_t j = 0; j < cell_count; j++)
+		modified[j] = !is_identity(&state[j], j);
+
+	for(size_t j = 1; j < cell_count; j++) {
+		reset[j] = modified[j];
+
+		for(size_t k = 0; k < cell_count; k++)
+			if(modified[k] && state[j].coef[k]) reset[j] = false;
+	}
+
+	reset[0] = false;
+	changing[0] = true;
+
+	for(size_t j = 1; j < cell_count; j++) {
+		steady[j] = state[j];
+		substitute(&steady[j], reset);
+
+		changing[j] = modified[j] && !reset[j]
+			&& !is_identity(&steady[j], j);
+	}
+
+	bool stable[MAX_CELLS];
+	for(size_t j = 0; j < cell_count; j++)
+		stable[j] = modified[j] && !reset[j] && !changing[j];
+
+	memset(result, 0, sizeof(affine_t) * cell_count);
+	memset(product, 0, sizeof(affine_t) * cell_count);
+
+	for(size_t j = 1; j < cell_count; j++) {
+		if(!modified[j]) { result[j].coef[j] = 1; continue; }
+
+		result[j] = state[j];
+		if(!changing[j]) continue;
+
+		if(steady[j].coef[j] != 1) return false;
+
+		for(size_t k = 0; k < cell_count; k++)
+			if(k != j && changing[k] && steady[j].coef[k]) return false;
+
+		affine_t gain = steady[j];
+		gain.coef[j] = 0;
+		substitute(&gain, stable);
+
+		add_scaled(&result[j], &gain, 255);
+		result[j].coef[0] += times * gain.value;
+
+		for(size_t k = 0; k < cell_count; k++)
+			product[j].coef[k] = times * gain.coef[k];
+	}
+
+	for(size_t j = 1; j < cell_count; j++) {
+		if(result[j].coef[j] > 1 || product[j].coef[j]) return false;
+	}
+
+	bool done[MAX_CELLS];
+	size_t targets = 0;
+
+	for(size_t j = 0; j < cell_count; j++) {
+		done[j] = !modified[j];
+		if(modified[j]) targets++;
+	}
+
+	for(*count = 0; *count < targets;) {
+		bool progress = false;
+
+		for(size_t k = 0; k < cell_count; k++) {
+			if(done[k]) continue;
+
+			bool free = true;
+			for(size_t j = 0; j < cell_count; j++)
+				if(!done[j] && j != k && reads(j, k)) free = false;
+
+			if(!free) continue;
+
+			order[(*count)++] = k;
+			done[k] = progress = true;
+		}
+
+		if(!progress) return false;
+	}
+
+	return true;
+}
+
+/* Runs the body once on symbolic values, where each cell holds a linear
+ * combination of the cells' values before the iteration plus a constant. */
+
+static bool run(BFi_instr_t *start, BFi_instr_t *end) {
+	cell_count = 0;
+	find_cell(start -> ad1);
+
+	for(BFi_instr_t *i = start -> next; i != end; i = i -> next) {
+		if(find_cell(i -> ad1) == MAX_CELLS) return false;
+		if(i -> opcode < BFI_INSTR_MULA || i -> opcode > BFI_INSTR_CPYM)
+			continue;
+
+		if(find_cell(i -> ad2) == MAX_CELLS) return false;
+	}
+
+	memset(state, 0, sizeof(affine_t) * cell_count);
+	for(size_t j = 0; j < cell_count; j++) state[j].coef[j] = 1;
+
+	for(BFi_instr_t *i = start -> next; i != end; i = i -> next) {
+		affine_t *cell = &state[find_cell(i -> ad1)];
+		unsigned char k = 1;
+
+		switch(i -> opcode) {
+		case BFI_INSTR_INC:
+			cell -> value += i -> op1;
+			continue;
+
+		case BFI_INSTR_DEC:
+			cell -> value -= i -> op1;
+			continue;
+
+		case BFI_INSTR_MOV:
+			memset(cell, 0, sizeof(affine_t));
+			cell -> value = i -> op1;
+			continue;
+
+		case BFI_INSTR_CMPL:
+			for(size_t j = 0; j < cell_count; j++)
+				cell -> coef[j] = -cell -> coef[j];
+
+			cell -> value = -cell -> value;
+			continue;
+
+		case BFI_INSTR_MULA: case BFI_INSTR_MULS: case BFI_INSTR_MULM:
+			k = i -> op1;
+			break;
+
+		case BFI_INSTR_SHLA: case BFI_INSTR_SHLS: case BFI_INSTR_SHLM:
+			k = 1 << i -> op2;
+		}
+
+		affine_t src = state[find_cell(i -> ad2)];
+
+		switch(i -> opcode) {
+		case BFI_INSTR_MULS: case BFI_INSTR_SHLS: case BFI_INSTR_CPYS:
+			k = -k;
+			break;
+
+		case BFI_INSTR_MULM: case BFI_INSTR_SHLM: case BFI_INSTR_CPYM:
+			memset(cell, 0, sizeof(affine_t));
+		}
+
+		add_scaled(cell, &src, k);
+	}
+
+	return true;
+}
+
+static size_t find_cell(ssize_t ad) {
+	for(size_t j = 0; j < cell_count; j++) if(cells[j] == ad) return j;
+	if(cell_count == MAX_CELLS) return MAX_CELLS;
+
+	cells[cell_count] = ad;
+	return cell_count++;
+}
+
+static bool is_identity(const affine_t *expr, size_t cell) {
+	if(expr -> value) return false;
+
+	for(size_t k = 0; k < cell_count; k++)
+		if(expr -> coef[k] != (k == cell)) return false;
+
+	return true;
+}
+
+static void add_scaled(affine_t *to, const affine_t *from, unsigned char k) {
+	for(size_t j = 0; j < cell_count; j++) to -> coef[j] += k * from -> coef[j];
+	to -> value += k * from -> value;
+}
+
+static void substitute(affine_t *expr, const bool *which) {
+	for(size_t k = 0; k < cell_count; k++) {
+		unsigned char coef = expr -> coef[k];
+		if(!which[k] || !coef) continue;
+
+		expr -> coef[k] = 0;
+		add_scaled(expr, &state[k], coef);
+	}
+}
+
+static bool reads(size_t j, size_t k) {
+	if(j == k) return false;
+	if(result[j].coef[k] || product[j].coef[k]) return true;
+	if(k) return false;
+
+	for(size_t i = 0; i < cell_count; i++)
+		if(product[j].coef[i]) return true;
+
+	return false;
+}
+
+static BFi_instr_t *emit(BFi_instr_t *prev, int opcode, size_t op1,
+			 size_t op2, ssize_t ad1, ssize_t ad2)
+{
+	BFi_instr_t *new = malloc(sizeof(BFi_instr_t));
+	if(!new) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	new -> prev = prev; new -> next = prev -> next;
+	new -> ptr = NULL;
+	new -> opcode = opcode;
+	new -> op1 = op1; new -> op2 = op2;
+	new -> ad1 = ad1; new -> ad2 = ad2;
+
+	prev -> next -> prev = new;
+	prev -> next = new;
+	return new;
+}
+
+static BFi_instr_t *emit_term(BFi_instr_t *prev, ssize_t ad1, ssize_t ad2,
+			      unsigned char k)
+{
+	unsigned char neg = -k;
+	size_t shift = 0;
+
+	if(k == 1) return emit(prev, BFI_INSTR_CPYA, 0, 0, ad1, ad2);
+	if(k == 255) return emit(prev, BFI_INSTR_CPYS, 0, 0, ad1, ad2);
+
+	if(IS_2_POW(k)) {
+		while(k >> ++shift);
+		return emit(prev, BFI_INSTR_SHLA, 0, shift - 1, ad1, ad2);
+	}
+
+	if(IS_2_POW(neg)) {
+		while(neg >> ++shift);
+		return emit(prev, BFI_INSTR_SHLS, 0, shift - 1, ad1, ad2);
+	}
+
+	if(k < 128) return emit(prev, BFI_INSTR_MULA, k, 0, ad1, ad2);
+	return emit(prev, BFI_INSTR_MULS, neg, 0, ad1, ad2);
+}
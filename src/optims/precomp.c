@@ -19,6 +19,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "blocks.h"
+#include "consts.h"
+#include "dead.h"
 #include "level_3.h"
 #include "precomp.h"
 
@@ -36,8 +39,6 @@ static list_t output_first;
 static size_t output_len = 0;
 
 static int _putchar(int ch);
-static void on_fwd(size_t op);
-static void on_bck(size_t op);
 
 BFi_instr_t *BFo_optimise_precomp() {
 	size_t last = 0, length = strlen(BFi_program_str);
@@ -61,9 +62,15 @@ n2:	if(!last) return BFo_optimise_lv3_2();
 	BFi_program_str[last + 1] = 0;
 	BFi_is_running = true;
 
-	if(saved) { BFi_on_fwd = on_fwd; BFi_on_bck = on_bck; }
 	BFi_putchar = _putchar;
 	BFi_exec();
+
+	if(saved) {
+		BFo_precomp_ptr = BFo_precomp_cells = BFi_mem_ptr;
+
+		for(size_t i = BFi_mem_ptr; i < BFi_mem_size; i++)
+			if(BFi_mem[i]) BFo_precomp_cells = i;
+	}
 	
 	if(!output_len) goto n3;
 
@@ -81,7 +88,12 @@ n3:	BFi_program_str[last + 1] = saved;
 	BFi_do_recompile = true;
 
 	BFo_precomp_cells++;
-	return BFo_optimise_lv3();
+
+	BFi_instr_t *start = BFo_optimise_lv3();
+	if(!BFo_advanced_ops) return start;
+	start = BFo_optimise_consts(start, false);
+	start = BFo_optimise_dead(start, BFo_zeroed_mem);
+	return BFo_optimise_blocks(start);
 }
 
 static int _putchar(int ch) {
@@ -96,15 +108,4 @@ static int _putchar(int ch) {
 	output_len++;
 
 	return 0;
-}
-
-static void on_fwd(size_t op) {
-	if(BFi_mem_ptr > BFo_precomp_cells)
-		BFo_precomp_cells = BFi_mem_ptr;
-
-	BFo_precomp_ptr += op;
-}
-
-static void on_bck(size_t op) {
-	BFo_precomp_ptr -= op;
 }
\ No newline at end of file
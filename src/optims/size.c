@@ -16,10 +16,11 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <pthread.h>
-#include <semaphore.h>
 #include <unistd.h>
 
 #include <sys/types.h>
@@ -32,35 +33,86 @@
 #include "../errors.h"
 #include "../optims.h"
 
+/* Repeats are found with a suffix array over the instruction list, where
+ * instructions that are_equal() share a token. Each LCP interval of the
+ * array is a set of positions sharing a common prefix, and is evaluated at
+ * its longest bracket-balanced length, as well as at the longest length at
+ * which none of its occurrences overlap. */
+
+typedef struct {
+	size_t left, right;
+	size_t length, parent;
+
+} range_t;
+
+/* Each round, the intervals are split evenly between a pool of threads that
+ * lives as long as the optimiser does. A thread takes small chunks from the
+ * front of its own share, and once that runs dry, steals the back half of
+ * another thread's share. Shares are packed into one word as [next, end) so
+ * that both ends can be claimed with a single compare-and-swap. */
+
+#define CHUNK_SIZE 16
+
 typedef struct {
-	BFi_instr_t **matches;
-	size_t length;
-	size_t count;
 	ssize_t savings;
-	ssize_t brackets;
+	size_t length, first, index;
+
+} best_t;
+
+typedef struct {
+	uint64_t share;
+	best_t best;
+
+	size_t index;
+	pthread_t thread;
 
-} ret_t;
+} data_t;
 
 static size_t total_nodes;
 static size_t thread_count;
-static sem_t mutex;
+
+static data_t *workers;
+static pthread_barrier_t start_barrier, finish_barrier;
+static bool stopping;
+
+static BFi_instr_t **nodes;
+static size_t *tokens, *suffixes, *lcps;
+static ssize_t *depths;
+static size_t *ends, *opens;
+
+static range_t *ranges;
+static size_t range_count;
 
 static BFi_instr_t *base, **matches;
 static size_t length, count;
 static ssize_t savings;
 
-static int are_equal(BFi_instr_t *a, BFi_instr_t *b);
+static int compare_nodes(const void *a, const void *b);
+static int compare_sizes(const void *a, const void *b);
 static void insert(BFi_instr_t **node);
 
-typedef struct {
-	BFi_instr_t *base;
-	size_t index;
+static void build_index(BFi_instr_t *start);
+static void build_suffixes();
+static void build_ranges();
+static void free_index();
 
-} data_t;
+static size_t balanced(size_t start, size_t max_length);
+static size_t disjoint(const size_t *positions, size_t size, size_t our_length,
+		       BFi_instr_t **out);
 
+static void start_workers();
+static void stop_workers();
 static void *call_eval(void *data_p);
-static void evaluate(BFi_instr_t *our_base, size_t index);
-static ret_t rec_eval(BFi_instr_t *our_base, ret_t data);
+
+static void run_worker(data_t *data);
+static bool take(data_t *data, size_t *from, size_t *to);
+static bool steal(data_t *data);
+
+static void evaluate(size_t index, best_t *our_best);
+static void submit(best_t *our_best, size_t index, size_t start,
+		   size_t our_length, size_t our_count);
+
+static bool is_better(const best_t *a, const best_t *b);
 
 BFi_instr_t *BFo_optimise_size(bool precomp) {
 	BFi_instr_t *start = precomp? BFo_optimise_precomp()
@@ -69,11 +121,15 @@ BFi_instr_t *BFo_optimise_size(bool precomp) {
 	BFi_instr_t *instr;
 	for(instr = start; instr; instr = instr -> next) {
 		switch(instr -> opcode) {
-		case BFI_INSTR_NOP: case BFI_INSTR_CMPL:
+		case BFI_INSTR_NOP:
 			instr -> op1 = instr -> op2 = 0;
 			instr -> ad1 = instr -> ad2 = 0;
 			break;
 
+		case BFI_INSTR_CMPL:
+			instr -> op1 = instr -> op2 = instr -> ad2 = 0;
+			break;
+
 		case BFI_INSTR_INC: case BFI_INSTR_DEC:
 			instr -> op2 = instr -> ad2 = 0;
 			break;
@@ -88,10 +144,14 @@ BFi_instr_t *BFo_optimise_size(bool precomp) {
 			break;
 
 		case BFI_INSTR_FWD: case BFI_INSTR_BCK:
-		case BFI_INSTR_LOOP: case BFI_INSTR_ENDL:
 			instr -> op2 = instr -> ad1 = instr -> ad2 = 0;
 			break;
 
+		case BFI_INSTR_LOOP: case BFI_INSTR_ENDL:
+		case BFI_INSTR_IFNZ: case BFI_INSTR_ENDIF:
+			instr -> op2 = instr -> ad2 = 0;
+			break;
+
 		case BFI_INSTR_INP: case BFI_INSTR_OUT:
 			instr -> op1 = instr -> op2 = instr -> ad2 = 0;
 			break;
@@ -99,44 +159,63 @@ BFi_instr_t *BFo_optimise_size(bool precomp) {
 		case BFI_INSTR_CPYA: case BFI_INSTR_CPYS:
 			instr -> op1 = instr -> op2 = 0;
 			break;
+
+		case BFI_INSTR_SCAN:
+			instr -> op2 = instr -> ad2 = 0;
+			break;
 		
 		}
 	}
 
-	thread_count = sysconf(_SC_NPROCESSORS_ONLN);
-	pthread_t threads[thread_count];
-	data_t thread_data[thread_count];
-
-	int ret = sem_init(&mutex, 0, 1);
-	if(ret == -1) BFe_report_err(BFE_UNKNOWN_ERROR);
+	start_workers();
 
 loop:	total_nodes = 0;
 	for(instr = start; instr; instr = instr -> next)
 		total_nodes++;
 
-	if(thread_count > total_nodes) thread_count = total_nodes;
+	if(total_nodes < 2) goto endl;
+	build_index(start);
 
-	instr = start;
 	for(size_t i = 0; i < thread_count; i++) {
-		thread_data[i].base = instr;
-		thread_data[i].index = i;
-
-		ret = pthread_create(&threads[i], NULL,
-			call_eval, (void *) &thread_data[i]);
-
-		if(ret == -1) BFe_report_err(BFE_UNKNOWN_ERROR);
-		else instr = instr -> next;
+		uint64_t from = range_count * i / thread_count;
+		uint64_t to = range_count * (i + 1) / thread_count;
+		workers[i].share = to << 32 | from;
 	}
 
-	for(size_t i = 0; i < thread_count; i++)
-		pthread_join(threads[i], NULL);
+	pthread_barrier_wait(&start_barrier);
+	run_worker(&workers[0]);
+	pthread_barrier_wait(&finish_barrier);
+
+	best_t result = workers[0].best;
+	for(size_t i = 1; i < thread_count; i++)
+		if(is_better(&workers[i].best, &result))
+			result = workers[i].best;
 
-	if(!base || !count || savings <= 0) {
-		if(matches) free(matches);
-	endl:	sem_destroy(&mutex);
+	if(result.savings <= 0) {
+		free_index();
+	endl:	stop_workers();
 		return start;
 	}
 
+	savings = result.savings;
+	length = result.length;
+
+	range_t *range = &ranges[result.index];
+	size_t size = range -> right - range -> left + 1;
+
+	size_t *positions = malloc(sizeof(size_t) * size);
+	matches = malloc(sizeof(BFi_instr_t *) * size);
+	if(!positions || !matches) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	memcpy(positions, &suffixes[range -> left], sizeof(size_t) * size);
+	qsort(positions, size, sizeof(size_t), compare_sizes);
+
+	count = disjoint(positions, size, length, matches);
+	base = nodes[result.first];
+
+	free(positions);
+	free_index();
+
 	for(instr = start; instr -> next; instr = instr -> next);
 	BFi_instr_t *end = instr;
 
@@ -197,7 +276,7 @@ loop:	total_nodes = 0;
 	BFo_sub_count++;
 	length = count = savings = 0;
 
-	if(matches) free(matches);
+	free(matches);
 	matches = NULL;
 	base = NULL;
 
@@ -205,24 +284,32 @@ loop:	total_nodes = 0;
 	else goto loop;
 }
 
-static int are_equal(BFi_instr_t *a, BFi_instr_t *b) {
-	if(!a || !b) return 0;
-	if(a -> opcode != b -> opcode) return 0;
-	
-	switch(a -> opcode) {
+static int compare_nodes(const void *a, const void *b) {
+	size_t i = *(const size_t *) a, j = *(const size_t *) b;
+	BFi_instr_t *x = nodes[i], *y = nodes[j];
+
+	if(x -> opcode != y -> opcode) return x -> opcode < y -> opcode ? -1 : 1;
+
+	switch(x -> opcode) {
 	case BFI_INSTR_SUB:
 	case BFI_INSTR_RTS:
-		return 0;
+		return (i > j) - (i < j);
 
-	case BFI_INSTR_LOOP:
-		return -1;
-
-	case BFI_INSTR_ENDL:
-		return -3;
+	case BFI_INSTR_LOOP: case BFI_INSTR_ENDL:
+	case BFI_INSTR_IFNZ: case BFI_INSTR_ENDIF:
+	case BFI_INSTR_SCAN:
+		return (x -> ad1 > y -> ad1) - (x -> ad1 < y -> ad1);
 	}
 
-	return (a -> op1 == b -> op1) && (a -> ad1 == b -> ad1)
-	    && (a -> op2 == b -> op2) && (a -> ad2 == b -> ad2);
+	if(x -> op1 != y -> op1) return x -> op1 < y -> op1 ? -1 : 1;
+	if(x -> ad1 != y -> ad1) return x -> ad1 < y -> ad1 ? -1 : 1;
+	if(x -> op2 != y -> op2) return x -> op2 < y -> op2 ? -1 : 1;
+	return (x -> ad2 > y -> ad2) - (x -> ad2 < y -> ad2);
+}
+
+static int compare_sizes(const void *a, const void *b) {
+	size_t x = *(const size_t *) a, y = *(const size_t *) b;
+	return (x > y) - (x < y);
 }
 
 static void insert(BFi_instr_t **node) {
@@ -238,108 +325,346 @@ static void insert(BFi_instr_t **node) {
 	(*node) -> ad1 = (*node) -> ad2 = 0;
 }
 
-static void *call_eval(void *data_p) {
-	data_t *data = (data_t *) data_p;
+static void build_index(BFi_instr_t *start) {
+	size_t n = total_nodes;
+
+	nodes = malloc(sizeof(BFi_instr_t *) * n);
+	tokens = malloc(sizeof(size_t) * (n + 1));
+	suffixes = malloc(sizeof(size_t) * (n + 1));
+	lcps = malloc(sizeof(size_t) * (n + 1));
+	depths = malloc(sizeof(ssize_t) * (n + 1));
+	ends = malloc(sizeof(size_t) * (n + 1));
+	opens = malloc(sizeof(size_t) * (n + 1));
+	ranges = malloc(sizeof(range_t) * (n + 1));
+
+	if(!nodes || !tokens || !suffixes || !lcps || !depths || !ends
+		|| !opens || !ranges) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	size_t i = 0;
+	for(BFi_instr_t *instr = start; instr; instr = instr -> next)
+		nodes[i++] = instr;
+
+	depths[0] = 0;
+	for(i = 0; i < n; i++) switch(nodes[i] -> opcode) {
+		case BFI_INSTR_LOOP: case BFI_INSTR_IFNZ:
+			depths[i + 1] = depths[i] + 1; break;
+
+		case BFI_INSTR_ENDL: case BFI_INSTR_ENDIF:
+			depths[i + 1] = depths[i] - 1; break;
+		default: depths[i + 1] = depths[i];
+	}
+
+	size_t *stack = malloc(sizeof(size_t) * (n + 1)), sp = 0;
+	if(!stack) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	for(i = 0; i <= n; i++) {
+		while(sp && depths[stack[sp - 1]] >= depths[i]) sp--;
+		opens[i] = sp ? stack[sp - 1] : 0;
+		stack[sp++] = i;
+	}
+
+	for(sp = 0, i = n + 1; i--;) {
+		while(sp && depths[stack[sp - 1]] >= depths[i]) sp--;
+		ends[i] = sp ? stack[sp - 1] - 1 : n;
+		stack[sp++] = i;
+	}
+
+	free(stack);
+
+	for(i = 0; i < n; i++) suffixes[i] = i;
+	qsort(suffixes, n, sizeof(size_t), compare_nodes);
+
+	tokens[suffixes[0]] = 1;
+	for(i = 1; i < n; i++) tokens[suffixes[i]] = tokens[suffixes[i - 1]]
+		+ (compare_nodes(&suffixes[i - 1], &suffixes[i]) != 0);
+
+	build_suffixes();
+	build_ranges();
+}
+
+static void build_suffixes() {
+	size_t n = total_nodes, m = 0;
+
+	size_t *ranks = malloc(sizeof(size_t) * n);
+	size_t *temp = malloc(sizeof(size_t) * n);
+	size_t *counts = calloc(n + 1, sizeof(size_t));
+	if(!ranks || !temp || !counts) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	for(size_t i = 0; i < n; i++) {
+		ranks[i] = tokens[i];
+		if(ranks[i] > m) m = ranks[i];
+		counts[ranks[i]]++;
+	}
 
-	while(data -> base) {
-		evaluate(data -> base, data -> index);
+	for(size_t i = 1; i <= m; i++) counts[i] += counts[i - 1];
+	for(size_t i = n; i--;) suffixes[--counts[ranks[i]]] = i;
 
-		for(size_t i = 0; i < thread_count && data -> base; i++)
-			data -> base = data -> base -> next;
+	for(size_t k = 1; m < n; k *= 2) {
+		size_t p = 0;
 
-		data -> index += thread_count;
+		for(size_t i = n > k ? n - k : 0; i < n; i++) temp[p++] = i;
+		for(size_t i = 0; i < n; i++)
+			if(suffixes[i] >= k) temp[p++] = suffixes[i] - k;
+
+		memset(counts, 0, sizeof(size_t) * (m + 1));
+		for(size_t i = 0; i < n; i++) counts[ranks[i]]++;
+		for(size_t i = 1; i <= m; i++) counts[i] += counts[i - 1];
+		for(size_t i = n; i--;)
+			suffixes[--counts[ranks[temp[i]]]] = temp[i];
+
+		temp[suffixes[0]] = m = 1;
+		for(size_t i = 1; i < n; i++) {
+			size_t a = suffixes[i - 1], b = suffixes[i];
+			size_t a2 = a + k < n ? ranks[a + k] : 0;
+			size_t b2 = b + k < n ? ranks[b + k] : 0;
+
+			if(ranks[a] != ranks[b] || a2 != b2) m++;
+			temp[b] = m;
+		}
+
+		size_t *swap = ranks;
+		ranks = temp;
+		temp = swap;
+	}
+
+	lcps[0] = 0;
+	for(size_t i = 0, h = 0; i < n; i++) {
+		size_t r = ranks[i] - 1;
+		if(!r) { h = 0; continue; }
+
+		size_t j = suffixes[r - 1];
+		while(i + h < n && j + h < n && tokens[i + h] == tokens[j + h])
+			h++;
+
+		lcps[r] = h;
+		if(h) h--;
+	}
+
+	free(ranks);
+	free(temp);
+	free(counts);
+}
+
+static void build_ranges() {
+	size_t n = total_nodes, sp = 0;
+
+	range_t *stack = malloc(sizeof(range_t) * (n + 1));
+	if(!stack) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	stack[sp++] = (range_t) {0, 0, 0, 0};
+	range_count = 0;
+
+	for(size_t i = 1; i <= n; i++) {
+		size_t lcp = i < n ? lcps[i] : 0, left = i - 1;
+
+		while(lcp < stack[sp - 1].length) {
+			range_t range = stack[--sp];
+			range.right = i - 1;
+			range.parent = lcp > stack[sp - 1].length
+				? lcp : stack[sp - 1].length;
+
+			ranges[range_count++] = range;
+			left = range.left;
+		}
+
+		if(lcp > stack[sp - 1].length)
+			stack[sp++] = (range_t) {left, 0, lcp, 0};
+	}
+
+	free(stack);
+}
+
+static void free_index() {
+	free(nodes);
+	free(tokens);
+	free(suffixes);
+	free(lcps);
+	free(depths);
+	free(ends);
+	free(opens);
+	free(ranges);
+}
+
+/* The longest prefix of the run at start, no longer than max_length, that is
+ * bracket-balanced and does not leave the loop that start lies in. */
+
+static size_t balanced(size_t start, size_t max_length) {
+	size_t end = start + max_length;
+	if(end > ends[start]) end = ends[start];
+
+	while(depths[end] > depths[start]) end = opens[end];
+	return end - start;
+}
+
+static size_t disjoint(const size_t *positions, size_t size, size_t our_length,
+		       BFi_instr_t **out)
+{
+	size_t num = 0, next = 0;
+
+	for(size_t i = 0; i < size; i++) {
+		if(positions[i] < next) continue;
+
+		if(out) out[num] = nodes[positions[i]];
+		next = positions[i] + our_length;
+		num++;
 	}
 
-	return NULL;
+	return num;
 }
 
-static void evaluate(BFi_instr_t *our_base, size_t index) {
-	BFi_instr_t **our_matches;
-	size_t our_length = 1, our_count = 0;
-	ssize_t our_savings = -1;
+static void start_workers() {
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	thread_count = cores > 1 ? cores : 1;
 
-	ssize_t our_brackets = are_equal(our_base, our_base);
-	our_brackets = our_brackets < 0 ? our_brackets + 2 : 0;
+	workers = calloc(thread_count, sizeof(data_t));
+	if(!workers) BFe_report_err(BFE_UNKNOWN_ERROR);
 
-	our_matches = malloc(sizeof(BFi_instr_t *) * (total_nodes - index));
-	if(!our_matches) BFe_report_err(BFE_UNKNOWN_ERROR);
+	int ret = pthread_barrier_init(&start_barrier, NULL, thread_count);
+	if(ret) BFe_report_err(BFE_UNKNOWN_ERROR);
 
-	for(BFi_instr_t *i = our_base; i; i = i -> next)
-		if(are_equal(our_base, i)) our_matches[our_count++] = i;
+	ret = pthread_barrier_init(&finish_barrier, NULL, thread_count);
+	if(ret) BFe_report_err(BFE_UNKNOWN_ERROR);
 
-	ret_t data = { our_matches, our_length + 1, our_count,
-		our_savings, our_brackets };
+	stopping = false;
 
-	data = rec_eval(our_base -> next, data);
+	for(size_t i = 0; i < thread_count; i++) {
+		workers[i].index = i;
+		if(!i) continue;
 
-	if(data.savings > our_savings && !data.brackets && our_brackets >= 0) {
-		free(our_matches);
+		ret = pthread_create(&workers[i].thread, NULL,
+			call_eval, (void *) &workers[i]);
 
-		our_matches = data.matches;
-		our_length = data.length;
-		our_count = data.count;
-		our_savings = data.savings;
-		our_brackets = data.brackets;
+		if(ret) BFe_report_err(BFE_UNKNOWN_ERROR);
 	}
+}
+
+static void stop_workers() {
+	stopping = true;
+	pthread_barrier_wait(&start_barrier);
+
+	for(size_t i = 1; i < thread_count; i++)
+		pthread_join(workers[i].thread, NULL);
 
-	else free(data.matches);
+	pthread_barrier_destroy(&start_barrier);
+	pthread_barrier_destroy(&finish_barrier);
+
+	free(workers);
+	workers = NULL;
+}
+
+static void *call_eval(void *data_p) {
+	data_t *data = (data_t *) data_p;
 
-	sem_wait(&mutex);
-	if(our_savings > savings && !our_brackets) {
-		if(matches) free(matches);
+	while(true) {
+		pthread_barrier_wait(&start_barrier);
+		if(stopping) return NULL;
 
-		base = our_base;
-		matches = our_matches;
-		length = our_length;
-		count = our_count;
-		savings = our_savings;
+		run_worker(data);
+		pthread_barrier_wait(&finish_barrier);
 	}
+}
+
+static void run_worker(data_t *data) {
+	size_t from, to;
+	data -> best = (best_t) {0, 0, 0, 0};
+
+	do {
+		while(take(data, &from, &to))
+			for(size_t i = from; i < to; i++)
+				evaluate(i, &data -> best);
+
+	} while(steal(data));
+}
+
+static bool take(data_t *data, size_t *from, size_t *to) {
+	uint64_t old = __atomic_load_n(&data -> share, __ATOMIC_ACQUIRE), new;
+
+	do {
+		uint64_t next = old & UINT32_MAX, end = old >> 32;
+		if(next >= end) return false;
 
-	else free(our_matches);
-	sem_post(&mutex);
+		*from = next;
+		*to = end - next > CHUNK_SIZE ? next + CHUNK_SIZE : end;
+		new = end << 32 | *to;
+
+	} while(!__atomic_compare_exchange_n(&data -> share, &old, new, true,
+		__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	return true;
 }
 
-static ret_t rec_eval(BFi_instr_t *our_base, ret_t data) {
-	BFi_instr_t **our_matches;
-	size_t our_length = data.length, our_count = 0;
-	ssize_t our_savings = 0, our_brackets = data.brackets;
+static bool steal(data_t *data) {
+	for(size_t i = 1; i < thread_count; i++) {
+		data_t *victim = &workers[(data -> index + i) % thread_count];
+		uint64_t old = __atomic_load_n(&victim -> share,
+			__ATOMIC_ACQUIRE), new, middle, end;
+
+		do {
+			uint64_t next = old & UINT32_MAX;
+			end = old >> 32;
+
+			if(next >= end) break;
+			middle = next + (end - next) / 2;
+			new = middle << 32 | next;
 
-	our_matches = malloc(sizeof(BFi_instr_t) * data.count);
-	if(!our_matches) BFe_report_err(BFE_UNKNOWN_ERROR);
+		} while(!__atomic_compare_exchange_n(&victim -> share, &old,
+			new, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
 
-	for(size_t i = 0; i < data.count; i++) {
-		BFi_instr_t *instr = data.matches[i];
-		for(size_t j = 1; j < data.length && instr; j++)
-			instr = instr -> next;
+		if((old & UINT32_MAX) >= (old >> 32)) continue;
 
-		if(i != data.count - 1)
-			if(instr == data.matches[i + 1]) continue;
+		__atomic_store_n(&data -> share, end << 32 | middle,
+			__ATOMIC_RELEASE);
 
-		if(are_equal(our_base, instr))
-			our_matches[our_count++] = data.matches[i];
+		return true;
 	}
 
-	int equality = are_equal(our_base, our_base);
-	our_brackets += equality < 0 ? equality + 2 : 0;
-	our_savings = (our_length - 1) * (our_count - 1) - 1;
+	return false;
+}
+
+static void evaluate(size_t index, best_t *our_best) {
+	range_t *range = &ranges[index];
+	size_t size = range -> right - range -> left + 1;
+
+	size_t *positions = malloc(sizeof(size_t) * size);
+	if(!positions) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	memcpy(positions, &suffixes[range -> left], sizeof(size_t) * size);
+	qsort(positions, size, sizeof(size_t), compare_sizes);
 
-	data.matches = our_matches;
-	data.length = our_length;
-	data.count = our_count;
-	data.savings = our_savings;
-	data.brackets = our_brackets;
+	size_t gap = SIZE_MAX;
+	for(size_t i = 1; i < size; i++)
+		if(positions[i] - positions[i - 1] < gap)
+			gap = positions[i] - positions[i - 1];
 
-	if(our_count <= 1) return data;
-	else data.length++;
-	
-	ret_t ret = rec_eval(our_base -> next, data);
+	size_t our_length = balanced(positions[0], range -> length);
+	submit(our_best, index, positions[0], our_length,
+		disjoint(positions, size, our_length, NULL));
 
-	if(ret.savings > our_savings && !ret.brackets && our_brackets >= 0) {
-		free(our_matches);
-		return ret;
+	if(gap < our_length) {
+		our_length = balanced(positions[0], gap);
+		submit(our_best, index, positions[0], our_length, size);
 	}
 
-	free(ret.matches);
-	data.length--;
-	return data;
-}
\ No newline at end of file
+	free(positions);
+}
+
+static void submit(best_t *our_best, size_t index, size_t start,
+		   size_t our_length, size_t our_count)
+{
+	if(our_length <= ranges[index].parent || our_length < 2) return;
+
+	best_t new = { (our_length - 1) * (our_count - 1), our_length,
+		start, index };
+
+	new.savings--;
+	if(new.savings > 0 && is_better(&new, our_best)) *our_best = new;
+}
+
+/* Ties go to the earliest and then the longest run, so that the result does
+ * not depend on how the work was split between threads. */
+
+static bool is_better(const best_t *a, const best_t *b) {
+	if(a -> savings != b -> savings) return a -> savings > b -> savings;
+	if(a -> first != b -> first) return a -> first < b -> first;
+	return a -> length > b -> length;
+}
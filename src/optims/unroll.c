@@ -0,0 +1,218 @@
+/* Bfcli: The Interactive Brainfuck Command-Line Interpreter
+ * Copyright (C) 2021-2022 Jyothiraditya Nellakra
+ *
+ * This program is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+
+#include "unroll.h"
+
+#include "../errors.h"
+#include "../interpreter.h"
+#include "../optims.h"
+
+/* A loop that is entered with a known value in its counter, and whose body
+ * changes the counter by the same amount every time around, runs a known
+ * number of times. It is written out in full when that fits in BFo_max_unroll
+ * instructions, and otherwise its body is repeated inside the loop as many
+ * times as fits and evenly divides the trip count, so that the test runs less
+ * often. Loops with other loops inside them are left alone to keep the growth
+ * within the budget, and nothing is unrolled when optimising for size. */
+
+#define MAX_DEPTH 16
+
+static bool scan(BFi_instr_t *open, BFi_instr_t **close, unsigned char *step,
+		 size_t *size, bool *labels);
+
+static void copy(BFi_instr_t *first, BFi_instr_t *last, BFi_instr_t *before,
+		 size_t *label);
+
+static size_t last_label(BFi_instr_t *start);
+static void drop(BFi_instr_t **start, BFi_instr_t *instr);
+
+BFi_instr_t *BFo_unroll_loop(BFi_instr_t **start, BFi_instr_t *open,
+			     unsigned char value)
+{
+	switch(BFo_level) {
+		case 'S': case 's': case 'A': case 'a': return open;
+	}
+
+	BFi_instr_t *close;
+	unsigned char step;
+	size_t size, trips, label = 0;
+	bool labels;
+
+	if(!scan(open, &close, &step, &size, &labels)) return open;
+
+	for(trips = 1; trips <= 256; trips++) {
+		value += step;
+		if(!value) break;
+	}
+
+	if(trips > 256) return open;
+	if(labels) label = last_label(*start);
+
+	BFi_instr_t *first = open -> next, *last = close -> prev;
+
+	if(trips * size <= BFo_max_unroll) {
+		for(size_t i = 1; i < trips; i++)
+			copy(first, last, close, &label);
+
+		drop(start, open);
+		drop(start, close);
+		return first;
+	}
+
+	for(size_t times = trips / 2; times > 1; times--) {
+		if(trips % times || times * size > BFo_max_unroll) continue;
+
+		for(size_t i = 1; i < times; i++)
+			copy(first, last, close, &label);
+
+		break;
+	}
+
+	return open;
+}
+
+/* Finds the end of the loop, the amount its counter goes up by on each pass
+ * and the size of its body, failing if the counter changes in any other way or
+ * the pointer might not come back to where it started. */
+
+static bool scan(BFi_instr_t *open, BFi_instr_t **close, unsigned char *step,
+		 size_t *size, bool *labels)
+{
+	ssize_t offset = 0;
+	size_t depth = 0;
+
+	*step = 0;
+	*size = 0;
+	*labels = false;
+
+	for(BFi_instr_t *instr = open -> next; instr; instr = instr -> next) {
+		ssize_t ad = offset + instr -> ad1;
+
+		switch(instr -> opcode) {
+		case BFI_INSTR_FWD:
+			offset += instr -> op1;
+			break;
+
+		case BFI_INSTR_BCK:
+			offset -= instr -> op1;
+			break;
+
+		case BFI_INSTR_IFNZ:
+			if(++depth > MAX_DEPTH) return false;
+			*labels = true;
+			break;
+
+		case BFI_INSTR_ENDIF:
+			depth--;
+			break;
+
+		case BFI_INSTR_ENDL:
+			*close = instr;
+			return !offset && instr -> ad1 == open -> ad1 && *step;
+
+		case BFI_INSTR_INC: case BFI_INSTR_DEC:
+			if(ad != open -> ad1) break;
+			if(depth) return false;
+
+			*step += instr -> opcode == BFI_INSTR_INC ?
+				instr -> op1 : -instr -> op1;
+			break;
+
+		case BFI_INSTR_NOP:
+			continue;
+
+		case BFI_INSTR_OUT:
+			break;
+
+		case BFI_INSTR_CMPL: case BFI_INSTR_MOV:
+		case BFI_INSTR_INP:
+		case BFI_INSTR_MULA: case BFI_INSTR_MULS: case BFI_INSTR_MULM:
+		case BFI_INSTR_SHLA: case BFI_INSTR_SHLS: case BFI_INSTR_SHLM:
+		case BFI_INSTR_CPYA: case BFI_INSTR_CPYS: case BFI_INSTR_CPYM:
+		case BFI_INSTR_PRDA:
+			if(ad == open -> ad1) return false;
+			break;
+
+		default:
+			return false;
+		}
+
+		(*size)++;
+	}
+
+	return false;
+}
+
+/* Copies the instructions from first to last in front of before, giving any
+ * IFNZs among them labels of their own. */
+
+static void copy(BFi_instr_t *first, BFi_instr_t *last, BFi_instr_t *before,
+		 size_t *label)
+{
+	size_t stack[MAX_DEPTH], depth = 0;
+
+	for(BFi_instr_t *instr = first;; instr = instr -> next) {
+		BFi_instr_t *new = malloc(sizeof(BFi_instr_t));
+		if(!new) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+		*new = *instr;
+		new -> ptr = NULL;
+
+		switch(instr -> opcode) {
+		case BFI_INSTR_IFNZ:
+			new -> op1 = stack[depth++] = ++*label;
+			break;
+
+		case BFI_INSTR_ENDIF:
+			new -> op1 = stack[--depth];
+		}
+
+		new -> prev = before -> prev;
+		new -> next = before;
+		before -> prev -> next = new;
+		before -> prev = new;
+
+		if(instr == last) return;
+	}
+}
+
+static size_t last_label(BFi_instr_t *start) {
+	size_t label = 0;
+
+	for(BFi_instr_t *instr = start; instr; instr = instr -> next) {
+		switch(instr -> opcode) {
+		case BFI_INSTR_LOOP: case BFI_INSTR_ENDL:
+		case BFI_INSTR_IFNZ: case BFI_INSTR_ENDIF:
+			if(instr -> op1 > label) label = instr -> op1;
+		}
+	}
+
+	return label;
+}
+
+static void drop(BFi_instr_t **start, BFi_instr_t *instr) {
+	if(instr -> prev) instr -> prev -> next = instr -> next;
+	else *start = instr -> next;
+
+	if(instr -> next) instr -> next -> prev = instr -> prev;
+	free(instr);
+}
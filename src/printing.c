@@ -31,6 +31,8 @@
 #include "main.h"
 #include "printing.h"
 
+static int describe(const BFi_op_t *op, size_t i, int width);
+static void cell(char *text, int32_t ad);
 static int hex_digits(size_t n);
 
 void BFp_print_about() {
@@ -141,12 +143,13 @@ void BFp_print_minihelp() {
 	puts("  Valid arguments are:\n");
 
 	puts("    -a, --about      | -h, --help       | -v, --version    | -m, --minimal");
-	puts("    -n, --no-ansi    | -f, --file FILE  |\n");
+	puts("    -n, --no-ansi    | -f, --file FILE  | -e, --embed      |\n");
 
 	puts("    -d, --direct-inp | -l, --length LEN | -r, --ram SIZE   | -t, --translate");
-	puts("    -x, --compile    | -s, --standalone |\n");
+	puts("    -x, --compile    | -s, --standalone | -j, --jit        | -b, --batch-inp\n");
 
-	puts("    -o, --output OUT | -A, --arch ARCH  | -O, --optim BAND | -M, --max-subs N\n");
+	puts("    -o, --output OUT | -A, --arch ARCH  | -O, --optim BAND | -M, --max-subs N");
+	puts("    -U, --unroll N   |\n");
 
 	puts("  Happy coding! :)\n");
 	exit(BFE_BAD_ARGS);
@@ -184,6 +187,8 @@ void BFp_print_usage() {
 	puts("  Note: If a file is specified with -f, the code buffer's length is set to LEN");
 	puts("        plus the file's length.\n");
 
+	puts("  Note: SIZE is rounded up to a whole number of pages.\n");
+
 	puts("    -t, --translate   Translates the file to C source code and exits.\n");
 	
 	puts("    -x, --compile     Generates assembly code intermixed with the C output.");
@@ -192,31 +197,62 @@ void BFp_print_usage() {
 	puts("    -s, --standalone  Generates a standalone .s assembly file. (Implies -x,");
 	puts("                      Incompatible with -d)\n");
 
+	puts("    -e, --embed       Translates the file to a C function, bf_run(), that can be");
+	puts("                      linked into other programs. (Implies -t, Incompatible");
+	puts("                      with -x, -s and -d)\n");
+
+	puts("  Note: bf_run(tape, len, read, write, ctx) clears the tape and runs the program");
+	puts("        on it, calling read(ctx) for input and write(ch, ctx) for output. It");
+	puts("        returns 0, or -1 if len is smaller than the memory the program needs.\n");
+
 	puts("    -d, --direct-inp  Disables input buffering. Characters are sent to");
 	puts("                      Brainfuck code without waiting for a newline.\n");
 
+	puts("    -b, --batch-inp   Reads input in large blocks, without any terminal");
+	puts("                      handling, when running a file. (Implied when stdin");
+	puts("                      is not a terminal)\n");
+
+	puts("    -j, --jit         Compiles code to native x86-64 instructions in memory");
+	puts("                      before running it. (Ignored on other hosts)\n");
+
 	puts("    -o, --output OUT  Sets the output file for the translated C code and the");
 	puts("                      memory dump to OUT.\n");
 
 	puts("    -A, --arch ARCH   Sets the assembly architecture to ARCH. Valid values are");
-	puts("                      amd64, i386, 8086, z80 (this feature is in beta) and bfir");
-	puts("                      (Intermediate compiler code representation).\n");
+	puts("                      amd64, i386, 8086, z80 (this feature is in beta), bfir");
+	puts("                      (Intermediate compiler code representation) and elf64");
+	puts("                      (A static amd64 executable, without any assembler).\n");
 
 	puts("    -O, --optim BAND  Sets the optimisation band to BAND. Valid values are 0,");
-	puts("                      1, 2, 3, P/p, S/s and A/a.\n");
+	puts("                      1, 2, 3, P/p, S/s and A/a. The band also applies to");
+	puts("                      code run by the interpreter, where P/p falls back to 3");
+	puts("                      and A/a falls back to S/s.\n");
 
 	puts("    -M, --max-subs N  Sets the maximum number of subroutines and relocations");
 	puts("                      used by `-OS` to N. (N = 0 disables the limit.)\n");
 
+	puts("    -U, --unroll N    Sets the maximum number of instructions that a loop with a");
+	puts("                      known trip count may be unrolled into to N. (N = 0");
+	puts("                      disables unrolling, Ignored by `-OS`)\n");
+
 	puts("  Note: If no output file is specified, a filename is chosen automatically. The");
 	puts("        output filename of `-' designates stdout.\n");
 
 	puts("  Note: The following is the list of optimisations enabled by the --optim flags:\n");
 
 	puts("     0: No optimisations enabled beyond run-length compression.");
-	puts("     1: Merges most FWD and BCK operations into indexed INCs and DECs.");
-	puts("     2: Detects and converts loops into multiply-and-add operations.");
-	puts("     3: Optimises addition to zeroed-out cells away to a simple copy.\n");
+	puts("     1: Merges most FWD and BCK operations into indexed INCs, DECs and");
+	puts("        loop tests, and runs a peephole pass over amd64, i386 and 8086");
+	puts("        assembly.");
+	puts("     2: Detects and converts loops into multiply-and-add operations and");
+	puts("        zero-cell scans.");
+	puts("     3: Optimises addition to zeroed-out cells away to a simple copy,");
+	puts("        flattens nested multiply loops into single updates, and folds");
+	puts("        cells with known values into constant moves, removing loops");
+	puts("        that can never run and writes that are never read. Runs of");
+	puts("        constant stores or adds to neighbouring cells are merged into");
+	puts("        block copies, and loops that run a known number of times are");
+	puts("        unrolled.\n");
 
 	puts("   P/p: Precomputes final values as far as possible.");
 	puts("   S/s: Moves repeated code to dedicated subroutines to save space.");
@@ -232,18 +268,13 @@ void BFp_print_bytecode() {
 	if(BFi_do_recompile) BFi_compile(false);
 	BFc_get_dimensions();
 
-	BFi_instr_t *instr = BFi_code;
-	BFi_instr_t *first = instr;
-	size_t total = 0;
-
-	while(first) { first = first -> next; total++; }
-	int width = hex_digits(total);
+	BFi_op_t *instr = BFi_bytecode;
+	int width = hex_digits(BFi_bytecode_len);
 
 	size_t column = 0, rows = 0;
 	BFc_width -= width + 7;
-	first = instr;
 
-	for(size_t i = 0; BFi_is_running && instr; i++) {
+	for(size_t i = 0; BFi_is_running && i < BFi_bytecode_len; i++) {
 		if(rows >= BFc_height * pages && !BFc_no_ansi && !no_pause) {
 			printf(":");
 
@@ -260,76 +291,10 @@ void BFp_print_bytecode() {
 			printf("\e[%zu;1H", BFc_height - 1);
 		}
 
-		size_t val = instr -> op1;
-		switch(instr -> opcode) {
-		case BFI_INSTR_NOP:
-			if(!column) column += printf("  %0*zx: nop %*s",
-				width, i, width, "");
-			else column += printf(" | nop %*s", width, "");
-			break;
-		
-		case BFI_INSTR_INP:
-			if(!column) column += printf("  %0*zx: inp %*s",
-				width, i, width, "");
-			else column += printf(" | inp %*s", width, "");
-			break;
-		
-		case BFI_INSTR_OUT:
-			if(!column) column += printf("  %0*zx: out %*s",
-				width, i, width, "");
-			else column += printf(" | out %*s", width, "");
-			break;
-		
-		case BFI_INSTR_INC:
-			if(!column) column += printf("  %0*zx: inc %*zx",
-				width, i, width, val);
-			else column += printf(" | inc %*zx", width, val);
-			break;
-		
-		case BFI_INSTR_DEC:
-			if(!column) column += printf("  %0*zx: dec %*zx",
-				width, i, width, val);
-			else column += printf(" | dec %*zx", width, val);
-			break;
-		
-		case BFI_INSTR_FWD:
-			if(!column) column += printf("  %0*zx: fwd %*zx",
-				width, i, width, val);
-			else column += printf(" | fwd %*zx", width, val);
-			break;
-		
-		case BFI_INSTR_BCK:
-			if(!column) column += printf("  %0*zx: bck %*zx",
-				width, i, width, val);
-			else column += printf(" | bck %*zx", width, val);
-			break;
-		}
-		
-		size_t index = i;
-
-		switch(instr -> opcode) {
-		case BFI_INSTR_JMP:
-			for(BFi_instr_t *j = instr; j; j = j -> prev) {
-				if(j == instr -> ptr) break;
-				else index--; 
-			}
-
-			if(!column) column += printf("  %0*zx: jmp %*zx",
-				width, i, width, index);
-			else column += printf(" | jmp %*zx", width, index);
-			break;
-		
-		case BFI_INSTR_JZ:
-			for(BFi_instr_t *j = instr; j; j = j -> next) {
-				if(j == instr -> ptr) break;
-				else index++; 
-			}
+		if(!column) column += printf("  %0*zx: ", width, i);
+		else column += printf(" | ");
 
-			if(!column) column += printf("  %0*zx: jz  %*zx",
-				width, i, width, index);
-			else column += printf(" | jz  %*zx", width, index);
-			break;
-		}
+		column += describe(instr, i, width);
 
 		if(column > BFc_width) {
 			putchar('\n');
@@ -337,7 +302,7 @@ void BFp_print_bytecode() {
 			rows++;
 		}
 
-		instr = instr -> next;
+		instr++;
 	}
 
 	if(column) putchar('\n');
@@ -440,6 +405,124 @@ void BFp_dump_mem() {
 	}
 }
 
+/* Cells are shown as hexadecimal offsets from the pointer in brackets and
+ * jumps as the index of the entry that runs next when they are taken, apart
+ * from JMP, which names its JZ as it did before lowering. */
+
+static int describe(const BFi_op_t *op, size_t i, int width) {
+	char a[16], b[16], c[16];
+	size_t target = i + op -> ad1 + 1;
+
+	cell(a, op -> ad1);
+	cell(b, op -> ad2);
+	cell(c, op -> ad3);
+
+	switch(op -> opcode) {
+	case BFI_INSTR_NOP:
+		return printf("nop %*s", width, "");
+
+	case BFI_INSTR_INP: case BFI_INSTR_OUT:
+		return printf("%s %*s%s%s", op -> opcode == BFI_INSTR_INP
+			? "inp" : "out", width, "", op -> ad1 ? " " : "",
+			op -> ad1 ? a : "");
+
+	case BFI_INSTR_INC: case BFI_INSTR_DEC:
+		return printf("%s %*x%s%s", op -> opcode == BFI_INSTR_INC
+			? "inc" : "dec", width, op -> op1, op -> ad1 ? " " : "",
+			op -> ad1 ? a : "");
+
+	case BFI_INSTR_FWD:
+		return printf("fwd %*" PRIx32, width, op -> ad1);
+
+	case BFI_INSTR_BCK:
+		return printf("bck %*" PRIx32, width, op -> ad1);
+
+	case BFI_INSTR_JMP:
+		return printf("jmp %*zx", width, target - 1);
+
+	case BFI_INSTR_JZ:
+		return printf("jz  %*zx", width, target);
+
+	case BFI_INSTR_LOOP:
+		return printf("loop %*zx %s", width, target, b);
+
+	case BFI_INSTR_ENDL:
+		return printf("endl %*zx %s", width, target, b);
+
+	case BFI_INSTR_IFNZ:
+		return printf("ifnz %*zx %s", width, target, b);
+
+	case BFI_INSTR_CMPL:
+		return printf("cmpl %s", a);
+
+	case BFI_INSTR_MOV:
+		return printf("mov %*x %s", width, op -> op1, a);
+
+	case BFI_INSTR_MULA:
+		return printf("mula %s, %s, %x", a, b, op -> op1);
+
+	case BFI_INSTR_MULS:
+		return printf("muls %s, %s, %x", a, b, op -> op1);
+
+	case BFI_INSTR_MULM:
+		return printf("mulm %s, %s, %x", a, b, op -> op1);
+
+	case BFI_INSTR_SHLA:
+		return printf("shla %s, %s, %x", a, b, op -> op2);
+
+	case BFI_INSTR_SHLS:
+		return printf("shls %s, %s, %x", a, b, op -> op2);
+
+	case BFI_INSTR_SHLM:
+		return printf("shlm %s, %s, %x", a, b, op -> op2);
+
+	case BFI_INSTR_CPYA:
+		return printf("cpya %s, %s", a, b);
+
+	case BFI_INSTR_CPYS:
+		return printf("cpys %s, %s", a, b);
+
+	case BFI_INSTR_CPYM:
+		return printf("cpym %s, %s", a, b);
+
+	case BFI_INSTR_SUB:
+		return printf("sub %*x", width, op -> op1);
+
+	case BFI_INSTR_JSR:
+		return printf("jsr %*zx", width, target);
+
+	case BFI_INSTR_RTS:
+		return printf("rts %*s", width, "");
+
+	case BFI_INSTR_RET:
+		return printf("ret %*s", width, "");
+
+	case BFI_INSTR_SCAN:
+		return printf("scan %s%" PRIx32, op -> ad1 < 0 ? "-" : "",
+			op -> ad1 < 0 ? -(uint32_t) op -> ad1
+			: (uint32_t) op -> ad1);
+
+	case BFI_INSTR_PRDA:
+		return printf("prda %s, %s, %s, %x", a, b, c, op -> op1);
+
+	case BFI_INSTR_SETB:
+		return printf("setb %s, %" PRIx32 ", %" PRIx32, a, op -> ad2,
+			op -> ad3);
+
+	case BFI_INSTR_ADDB:
+		return printf("addb %s, %" PRIx32 ", %" PRIx32, a, op -> ad2,
+			op -> ad3);
+
+	default:
+		return printf("??? %*x", width, op -> opcode);
+	}
+}
+
+static void cell(char *text, int32_t ad) {
+	if(ad < 0) sprintf(text, "[-%" PRIx32 "]", -(uint32_t) ad);
+	else sprintf(text, "[%" PRIx32 "]", (uint32_t) ad);
+}
+
 static int hex_digits(size_t n) {
 	int ret = 0;
 	while(n) { n /= 16; ret++; }
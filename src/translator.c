@@ -32,15 +32,54 @@
 #include "optims.h"
 #include "translator.h"
 
+#define REGION_SIZE 1024
+
 bool BFt_compile;
 bool BFt_translate;
 bool BFt_standalone;
+bool BFt_embed;
+
+typedef struct {
+	BFi_instr_t *start;
+	size_t size;
+
+} frame_t;
+
+typedef struct {
+	BFi_instr_t *start;
+	BFi_instr_t *end;
+
+} region_t;
+
+static region_t *regions;
+static size_t region_count;
+static size_t chars;
 
-BFi_instr_t *BFi_code;
+static const char *params = "";
+static const char *args = "";
+static const char *tape_end = "cells + sizeof(cells)";
 
+static void split();
+static int compare_regions(const void *a, const void *b);
+
+static void embed(FILE *file);
+static void image(FILE *file);
+static void table(FILE *file);
+static void prototypes(FILE *file);
+static void runtime(FILE *file);
 static void translate(FILE *file);
+static void statements(FILE *file, BFi_instr_t *instr, BFi_instr_t *end,
+	region_t *self);
 
 void BFt_translate_c() {
+	if(BFt_embed && (BFt_compile || BFc_direct_inp)) {
+		BFe_code_error = "--embed is incompatible with --compile, "
+			"--standalone and --direct-inp.";
+
+		BFe_report_err(BFE_INCOMPATIBLE_ARGS);
+		exit(BFE_INCOMPATIBLE_ARGS);
+	}
+
 	if(BFt_standalone) BFa_translate();
 
 	BFo_optimise();
@@ -64,64 +103,42 @@ void BFt_translate_c() {
 		exit(BFE_FILE_UNWRITABLE);
 	}
 
+	if(BFt_embed) {
+		embed(file);
+		goto close;
+	}
+
 	if(!BFt_compile || BFo_precomp_output)
-		fputs("#include <stdio.h>\n\n", file);
+		fputs("#include <stdio.h>\n", file);
 
+	if(!BFt_compile && BFi_program_str[0]) {
+		fputs("#include <string.h>\n", file);
+		fputs("#include <unistd.h>\n", file);
+	}
+
+	if(!BFt_compile || BFo_precomp_output) fputc('\n', file);
 	if(!BFi_program_str[0]) goto next;
 
 	if(BFc_direct_inp) {
 		fputs("#include <termios.h>\n", file);
-		fputs("#include <unistd.h>\n\n", file);
+		if(BFt_compile) fputs("#include <unistd.h>\n", file);
 
-		fputs("struct termios cooked, raw;\n", file);
+		fputs("\nstruct termios cooked, raw;\n", file);
 	}
 
-	fprintf(file, "unsigned char cells[%zu]", BFi_mem_size + BFo_mem_padding);
-
-	if(BFo_precomp_cells) {
-		fprintf(file, " = {\n\t");
-		size_t cols = 8;
-		char buf[16] = {0};
-
-		for(size_t i = 0; i < BFo_mem_padding + BFo_precomp_cells; i++) {
-			cols += sprintf(buf, "%d, ",
-				i < (unsigned) BFo_mem_padding?
-				0 : BFi_mem[i - BFo_mem_padding]);
-			
-			if(cols < 80) fprintf(file, "%s", buf);
-			else cols = fprintf(file, "\n\t%s", buf) + 5; 
-		}
-
-		fprintf(file, cols < 79? "0\n}" : "\n\t0\n}");
-	}
-
-	if(!BFt_compile) {
-		size_t index = BFo_mem_padding + BFo_precomp_ptr;
-
-		if(!index) fprintf(file, ", *p = cells");
-		else fprintf(file, ", *p = &cells[%zu]", index);
-
-		if(BFo_advanced_ops) fprintf(file, ", a = 0");
-	}
+	fprintf(file, BFt_compile? "unsigned char cells[%zu]"
+		: "static unsigned char cells[%zu]",
+		BFi_mem_size + BFo_mem_padding);
 
+	if(BFo_precomp_cells) image(file);
 	fprintf(file, ";\n\n");
+	if(BFt_compile) goto next;
 
-	if(!BFt_compile) {
-		fprintf(file, "#define in getchar\n");
-		fprintf(file, "#define out putchar\n\n");
-	}
-
-	static char line[BF_LINE_SIZE];
-	size_t chars = 0;
-
-	for(size_t i = 1; i < BFo_sub_count; i++) {
-		chars += sprintf(line, i == 1? "void _%zu()": "_%zu()", i) + 2;
+	table(file);
+	runtime(file);
+	split();
+	prototypes(file);
 
-		if(chars > 80) chars = fprintf(file, ",\n%s", line) - 1;
-		else fprintf(file, i == 1? "%s" : ", %s", line);
-	}
-
-	if(BFo_sub_count > 1) fputs(";\n\n", file);
 next:	fputs("int main() {\n", file);
 
 	if(BFc_direct_inp && BFi_program_str[0]) {
@@ -146,22 +163,291 @@ next:	fputs("int main() {\n", file);
 
 	fputs("}\n", file);
 
+close:	;
 	int ret = fclose(file);
 	if(ret == EOF) BFe_report_err(BFE_UNKNOWN_ERROR);
 	exit(0);
 }
 
-static void translate(FILE *file) {
+static void embed(FILE *file) {
+	params = ", struct bf_io *io";
+	args = ", io";
+	tape_end = "io -> end";
+
+	fputs("#include <stddef.h>\n", file);
+	fputs("#include <stdint.h>\n", file);
+	fputs("#include <string.h>\n\n", file);
+
+	fputs("struct bf_io {\n", file);
+	fputs("\tint (*read)(void *ctx);\n", file);
+	fputs("\tvoid (*write)(uint8_t ch, void *ctx);\n", file);
+	fputs("\tvoid *ctx;\n", file);
+	fputs("\tunsigned char *end;\n", file);
+	fputs("};\n\n", file);
+
+	fputs("#define in() io -> read(io -> ctx)\n", file);
+	fputs("#define out(ch) io -> write(ch, io -> ctx)\n\n", file);
+
+	if(BFo_precomp_cells) {
+		fputs("static const unsigned char cells[]", file);
+		image(file);
+		fputs(";\n\n", file);
+	}
+
+	if(BFo_precomp_output) {
+		fputs("static const char header[] = \"", file);
+		BFf_printstr(file, BFo_precomp_output, false);
+		fputs("\";\n\n", file);
+	}
+
+	table(file);
+	split();
+	prototypes(file);
+
+	fputs("int bf_run(uint8_t *tape, size_t len, int (*read)(void *ctx),\n",
+		file);
+	fputs("\tvoid (*write)(uint8_t ch, void *ctx), void *ctx)\n{\n", file);
+
+	fputs("\tstruct bf_io data = {read, write, ctx, tape + len}, "
+		"*io = &data;\n", file);
+	fprintf(file, "\tif(len < %zu) return -1;\n\n",
+		BFi_mem_size + BFo_mem_padding);
+
+	if(BFo_precomp_cells) {
+		fputs("\tmemcpy(tape, cells, sizeof(cells));\n", file);
+		fputs("\tmemset(tape + sizeof(cells), 0, "
+			"len - sizeof(cells));\n", file);
+	}
+
+	else fputs("\tmemset(tape, 0, len);\n", file);
+
+	if(BFo_precomp_output) {
+		fputs("\n\tfor(size_t i = 0; i < sizeof(header) - 1; i++)\n",
+			file);
+		fputs("\t\tout(header[i]);\n", file);
+	}
+
+	if(BFi_program_str[0]) {
+		fputc('\n', file);
+		translate(file);
+	}
+
+	else fputs("\n\treturn 0;\n", file);
+	fputs("}\n", file);
+}
+
+static void image(FILE *file) {
+	fprintf(file, " = {\n\t");
+	size_t cols = 8;
+	char buf[16] = {0};
+
+	for(size_t i = 0; i < BFo_mem_padding + BFo_precomp_cells; i++) {
+		cols += sprintf(buf, "%d, ",
+			i < (unsigned) BFo_mem_padding?
+			0 : BFi_mem[i - BFo_mem_padding]);
+		
+		if(cols < 80) fprintf(file, "%s", buf);
+		else cols = fprintf(file, "\n\t%s", buf) + 5; 
+	}
+
+	fprintf(file, cols < 79? "0\n}" : "\n\t0\n}");
+}
+
+static void table(FILE *file) {
+	if(!BFo_blocks_size) return;
+
+	fputs("static const unsigned char blocks[] = {\n\t", file);
+	size_t cols = 8;
+	char buf[16] = {0};
+
+	for(size_t i = 0; i < BFo_blocks_size; i++) {
+		cols += sprintf(buf, i + 1 < BFo_blocks_size? "%d, " : "%d",
+			BFo_blocks[i]);
+
+		if(cols < 80) fprintf(file, "%s", buf);
+		else cols = fprintf(file, "\n\t%s", buf) + 5;
+	}
+
+	fputs("\n};\n\n", file);
+}
+
+/* Keep the host compiler from inlining the regions straight back into one
+ * huge function. */
+
+static void prototypes(FILE *file) {
+	if(region_count) {
+		fputs("#ifdef __GNUC__\n", file);
+		fputs("#define noinline __attribute__((noinline))\n", file);
+		fputs("#else\n", file);
+		fputs("#define noinline\n", file);
+		fputs("#endif\n\n", file);
+	}
+
 	static char line[BF_LINE_SIZE];
-	size_t chars = 8;
-	char mode = 'a';
+	size_t chars = 0;
 
-	if(!BFi_program_str[0]) return;
-	else fputs("\t", file);
+	for(size_t i = 1; i < BFo_sub_count; i++) {
+		chars += sprintf(line, i == 1?
+			"static unsigned char *_%zu(unsigned char *p%s)":
+			"*_%zu(unsigned char *p%s)", i, params) + 2;
+
+		if(chars > 80) chars = fprintf(file, ",\n%s", line) - 1;
+		else fprintf(file, i == 1? "%s" : ", %s", line);
+	}
+
+	if(BFo_sub_count > 1) fputs(";\n\n", file);
+	chars = 0;
+
+	for(size_t i = 1; i <= region_count; i++) {
+		chars += sprintf(line, i == 1?
+			"static noinline unsigned char *_r%zu(unsigned char *p%s)":
+			"*_r%zu(unsigned char *p%s)", i, params) + 2;
+
+		if(chars > 80) chars = fprintf(file, ",\n%s", line) - 1;
+		else fprintf(file, i == 1? "%s" : ", %s", line);
+	}
+
+	if(region_count) fputs(";\n\n", file);
+}
+
+static void split() {
+	size_t depth = 0, max_depth = 16, max = 16;
+
+	frame_t *frames = malloc(sizeof(frame_t) * max_depth);
+	regions = malloc(sizeof(region_t) * max);
+	if(!(frames && regions)) BFe_report_err(BFE_UNKNOWN_ERROR);
+
+	frames[0] = (frame_t) {BFi_code, 0};
+	region_count = 0;
 
 	for(BFi_instr_t *instr = BFi_code; instr; instr = instr -> next) {
+		size_t size = 1;
+
+		switch(instr -> opcode) {
+		case BFI_INSTR_LOOP: case BFI_INSTR_IFNZ:
+			if(++depth == max_depth) {
+				max_depth *= 2;
+				frames = realloc(frames,
+					sizeof(frame_t) * max_depth);
+
+				if(!frames) BFe_report_err(BFE_UNKNOWN_ERROR);
+			}
+
+			frames[depth] = (frame_t) {instr -> next, 0};
+			continue;
+
+		case BFI_INSTR_ENDL: case BFI_INSTR_ENDIF:
+			size = frames[depth--].size + 2;
+			break;
+
+		case BFI_INSTR_SUB: case BFI_INSTR_RET:
+			goto done;
+		}
+
+		frame_t *frame = &frames[depth];
+		frame -> size += size;
+		if(frame -> size < REGION_SIZE) continue;
+
+		if(region_count == max) {
+			max *= 2;
+			regions = realloc(regions, sizeof(region_t) * max);
+			if(!regions) BFe_report_err(BFE_UNKNOWN_ERROR);
+		}
+
+		regions[region_count++] = (region_t) {frame -> start, instr};
+		frame -> start = instr -> next;
+		frame -> size = 1;
+	}
+
+done:	free(frames);
+	qsort(regions, region_count, sizeof(region_t), compare_regions);
+}
+
+static int compare_regions(const void *a, const void *b) {
+	uintptr_t start_a = (uintptr_t) ((const region_t *) a) -> start;
+	uintptr_t start_b = (uintptr_t) ((const region_t *) b) -> start;
+
+	return (start_a > start_b) - (start_a < start_b);
+}
+
+static void runtime(FILE *file) {
+	fputs("static unsigned char input[65536], output[65536];\n", file);
+	fputs("static size_t inp_pos, inp_len, out_len;\n\n", file);
+
+	fputs("static void flush() {\n", file);
+	fputs("\tfwrite(output, 1, out_len, stdout);\n", file);
+	fputs("\tfflush(stdout);\n", file);
+	fputs("\tout_len = 0;\n", file);
+	fputs("}\n\n", file);
+
+	fputs("static inline void out(unsigned char ch) {\n", file);
+	fputs("\toutput[out_len++] = ch;\n", file);
+	fputs("\tif(out_len == sizeof(output)) flush();\n", file);
+	fputs("}\n\n", file);
+
+	fputs("static inline unsigned char in() {\n", file);
+	fputs("\tif(inp_pos == inp_len) {\n", file);
+	fputs("\t\tflush();\n", file);
+	fputs("\t\tssize_t len = read(STDIN_FILENO, input, "
+		"sizeof(input));\n", file);
+	fputs("\t\tif(len <= 0) return EOF;\n\n", file);
+	fputs("\t\tinp_pos = 0;\n", file);
+	fputs("\t\tinp_len = len;\n", file);
+	fputs("\t}\n\n", file);
+	fputs("\treturn input[inp_pos++];\n", file);
+	fputs("}\n\n", file);
+}
+
+static void translate(FILE *file) {
+	if(!BFi_program_str[0]) return;
+
+	fprintf(file, BFt_embed? "\tunsigned char *restrict p = tape + %zu;\n\t"
+		: "\tunsigned char *restrict p = &cells[%zu];\n\t",
+		BFo_mem_padding + BFo_precomp_ptr);
+
+	BFi_instr_t *subs = BFi_code;
+	while(subs && subs -> opcode != BFI_INSTR_RET
+		&& subs -> opcode != BFI_INSTR_SUB) subs = subs -> next;
+
+	chars = 8;
+	statements(file, BFi_code, subs, NULL);
+	if(BFt_embed) fputs(chars >= 80? "\n\treturn 0;" : "return 0;", file);
+	else fputs(chars >= 80? "\n\tflush();" : "flush();", file);
+
+	for(size_t i = 0; i < region_count; i++) {
+		fprintf(file, "\n}\n\nstatic unsigned char *_r%zu("
+			"unsigned char *restrict p%s) {\n\t", i + 1, params);
+
+		chars = 8;
+		statements(file, regions[i].start, regions[i].end -> next,
+			&regions[i]);
+		fputs(chars >= 80? "\n\treturn p;" : "return p;", file);
+	}
+
+	if(subs) statements(file, subs, NULL, NULL);
+	fputc('\n', file);
+}
+
+static void statements(FILE *file, BFi_instr_t *instr, BFi_instr_t *end,
+	region_t *self)
+{
+	static char line[BF_LINE_SIZE];
+	size_t len;
+
+	for(; instr != end; instr = instr -> next) {
+		region_t key = {instr, NULL}, *region = bsearch(&key, regions,
+			region_count, sizeof(region_t), compare_regions);
+
+		if(region && region != self) {
+			sprintf(line, "p = _r%zu(p%s); ", region - regions + 1, args);
+			chars += strlen(line);
+			instr = region -> end;
+			goto put;
+		}
+
 		size_t op1 = instr -> op1, op2 = instr -> op2;
 		ssize_t ad1 = instr -> ad1, ad2 = instr -> ad2;
+		const char *mode = "+=";
 
 		switch(instr -> opcode) {
 		case BFI_INSTR_INC:
@@ -177,10 +463,28 @@ static void translate(FILE *file) {
 			break;
 
 		case BFI_INSTR_CMPL:
-			chars += sprintf(line, "*p = -*p; ");
+			chars += ad1
+				? sprintf(line, "p[%zd] = -p[%zd]; ", ad1, ad1)
+				: sprintf(line, "*p = -*p; ");
 			break;
 
 		case BFI_INSTR_MOV:
+			len = 1;
+
+			for(BFi_instr_t *next = instr -> next; next
+				&& next -> opcode == BFI_INSTR_MOV
+				&& next -> op1 == op1
+				&& next -> ad1 == ad1 + (ssize_t) len;
+				next = next -> next) len++;
+
+			if(len >= 4) {
+				chars += sprintf(line, "memset(&p[%zd], %zu, %zu); ",
+					ad1, op1, len);
+
+				while(--len) instr = instr -> next;
+				break;
+			}
+
 			chars += ad1
 				? sprintf(line, "p[%zd] = %zu; ", ad1, op1)
 				: sprintf(line, "*p = %zu; ", op1);
@@ -205,182 +509,102 @@ static void translate(FILE *file) {
 			break;
 
 		case BFI_INSTR_LOOP:
-			chars += sprintf(line, "while(*p) { ");
+			chars += ad1 ? sprintf(line, "if(p[%zd]) { do { ", ad1)
+				: sprintf(line, "if(*p) { do { ");
 			break;
 
 		case BFI_INSTR_ENDL:
-			chars += sprintf(line, "} ");
+			chars += ad1 ? sprintf(line, "} while(p[%zd]); } ", ad1)
+				: sprintf(line, "} while(*p); } ");
 			break;
 
 		case BFI_INSTR_IFNZ:
-			chars += sprintf(line, "if(*p) { ");
+			chars += ad1 ? sprintf(line, "if(p[%zd]) { ", ad1)
+				: sprintf(line, "if(*p) { ");
 			break;
 
 		case BFI_INSTR_ENDIF:
 			chars += sprintf(line, "} ");
 			break;
 
-		case BFI_INSTR_MULA:
-			if(instr -> prev -> opcode != BFI_INSTR_MULA
-				|| instr -> prev -> op1 != op1)
-			{
-				if(ad2) chars += sprintf(line,
-					"a = p[%zd] * %zu; ", ad2, op1);
-
-				else chars += sprintf(line,
-					"a = *p * %zu; ", op1);
-			}
-
-			else line[0] = 0;
-
-			mode = 'a';
-			goto next;
-
-		case BFI_INSTR_MULS:
-			if(instr -> prev -> opcode != BFI_INSTR_MULS
-				|| instr -> prev -> op1 != op1)
-			{
-				if(ad2) chars += sprintf(line,
-					"a = p[%zd] * %zu; ", ad2, op1);
-					
-				else chars += sprintf(line,
-					"a = *p * %zu; ", op1);
-			}
-
-			else line[0] = 0;
-
-			mode = 's';
-			goto next;
-
-		case BFI_INSTR_MULM:
-			if(instr -> prev -> opcode != BFI_INSTR_MULM
-				|| instr -> prev -> op1 != op1)
-			{
-				if(ad2) chars += sprintf(line,
-					"a = p[%zd] * %zu; ", ad2, op1);
-					
-				else chars += sprintf(line,
-					"a = *p * %zu; ", op1);
-			}
-
-			else line[0] = 0;
-
-			mode = 'm';
-			goto next;
-
-		case BFI_INSTR_SHLA:
-			if(instr -> prev -> opcode != BFI_INSTR_SHLA
-				|| instr -> prev -> op2 != op2)
-			{
-				if(ad2) chars += sprintf(line,
-					"a = p[%zd] << %zu; ", ad2, op2);
-					
-				else chars += sprintf(line,
-					"a = *p << %zu; ", op2);
-			}
-
-			else line[0] = 0;
-
-			mode = 'a';
-			goto next;
-
-		case BFI_INSTR_SHLS:
-			if(instr -> prev -> opcode != BFI_INSTR_SHLS
-				|| instr -> prev -> op2 != op2)
-			{
-				if(ad2) chars += sprintf(line,
-					"a = p[%zd] << %zu; ", ad2, op2);
-					
-				else chars += sprintf(line,
-					"a = *p << %zu; ", op2);
-			}
-
-			else line[0] = 0;
-
-			mode = 's';
-			goto next;
-
-		case BFI_INSTR_SHLM:
-			if(instr -> prev -> opcode != BFI_INSTR_SHLM
-				|| instr -> prev -> op2 != op2)
-			{
-				if(ad2) chars += sprintf(line,
-					"a = p[%zd] << %zu; ", ad2, op2);
-					
-				else chars += sprintf(line,
-					"a = *p << %zu; ", op2);
-			}
-
-			else line[0] = 0;
-
-			mode = 'm';
-			goto next;
+		case BFI_INSTR_SCAN:
+			if(ad1 == 1) chars += sprintf(line, "if(*p) { p = memchr(p, "
+				"0, %s - p); } ", tape_end);
 
-		case BFI_INSTR_CPYA:
-			if(instr -> prev -> opcode != BFI_INSTR_CPYA
-				|| instr -> prev -> op1 != op1)
-			{
-				if(ad2) chars += sprintf(line,
-					"a = p[%zd]; ", ad2);
-					
-				else chars += sprintf(line,
-					"a = *p; ");
-			}
-
-			else line[0] = 0;
-
-			mode = 'a';
-			goto next;
+			else chars += ad1 > 0
+				? sprintf(line, "while(*p) { p += %zd; } ", ad1)
+				: sprintf(line, "while(*p) { p -= %zd; } ", -ad1);
+			break;
 
-		case BFI_INSTR_CPYS:
-			if(instr -> prev -> opcode != BFI_INSTR_CPYS
-				|| instr -> prev -> op1 != op1)
-			{
-				if(ad2) chars += sprintf(line,
-					"a = p[%zd]; ", ad2);
-					
-				else chars += sprintf(line,
-					"a = *p; ");
+		case BFI_INSTR_MULS: case BFI_INSTR_SHLS: case BFI_INSTR_CPYS:
+			mode = "-=";
+			goto assign;
+
+		case BFI_INSTR_MULM: case BFI_INSTR_SHLM: case BFI_INSTR_CPYM:
+			mode = "=";
+			/* fall through */
+
+		case BFI_INSTR_MULA: case BFI_INSTR_SHLA: case BFI_INSTR_CPYA:
+		assign:	switch(instr -> opcode) {
+			case BFI_INSTR_MULA: case BFI_INSTR_MULS:
+			case BFI_INSTR_MULM:
+				chars += sprintf(line, "p[%zd] %s p[%zd] * %zu; ",
+					ad1, mode, ad2, op1);
+				break;
+
+			case BFI_INSTR_SHLA: case BFI_INSTR_SHLS:
+			case BFI_INSTR_SHLM:
+				chars += sprintf(line, "p[%zd] %s p[%zd] << %zu; ",
+					ad1, mode, ad2, op2);
+				break;
+
+			default:
+				chars += sprintf(line, "p[%zd] %s p[%zd]; ",
+					ad1, mode, ad2);
 			}
 
-			else line[0] = 0;
-
-			mode = 's';
-			goto next;
-
-		case BFI_INSTR_CPYM:
-			if(instr -> prev -> opcode != BFI_INSTR_CPYM
-				|| instr -> prev -> op1 != op1)
-			{
-				if(ad2) chars += sprintf(line,
-					"a = p[%zd]; ", ad2);
-					
-				else chars += sprintf(line,
-					"a = *p; ");
-			}
+			break;
 
-			else line[0] = 0;
+		case BFI_INSTR_PRDA:
+			chars += sprintf(line, "p[%zd] += p[%zd] * p[%zd] * %zu; ",
+				ad1, ad2, (ssize_t) op2, op1);
+			break;
 
-			mode = 'm';
+		case BFI_INSTR_SETB:
+			for(len = 1; len < op1; len++)
+				if(BFo_blocks[op2 + len] != BFo_blocks[op2]) break;
 
-		next:	if(chars >= 80) chars = fprintf(file, "\n\t%s", line) + 6;
-			else fputs(line, file);
+			chars += len == op1
+				? sprintf(line, "memset(&p[%zd], %d, %zu); ",
+					ad1, BFo_blocks[op2], op1)
+				: sprintf(line, "memcpy(&p[%zd], &blocks[%zu], "
+					"%zu); ", ad1, op2, op1);
+			break;
 
-			chars += sprintf(line, mode == 'a'? "p[%zd] += a; " :
-				mode == 's'? "p[%zd] -= a; " :
-				"p[%zd] = a; ", ad1);
+		case BFI_INSTR_ADDB:
+			chars += ad1
+				? sprintf(line, "for(int i = 0; i < %zu; i++) "
+					"p[%zd + i] += blocks[%zu + i]; ",
+					op1, ad1, op2)
+				: sprintf(line, "for(int i = 0; i < %zu; i++) "
+					"p[i] += blocks[%zu + i]; ", op1, op2);
 			break;
 
 		case BFI_INSTR_SUB:
-			fprintf(file, "\n}\n\nvoid _%zu() {\n\t", op1);
+			fprintf(file, "\n}\n\nstatic unsigned char *_%zu("
+				"unsigned char *restrict p%s) {\n\t", op1, params);
+
 			chars = 8;
 			continue;
 
 		case BFI_INSTR_JSR:
-			chars += sprintf(line, "_%zu(); ", op1);
+			chars += sprintf(line, "p = _%zu(p%s); ", op1, args);
 			break;
 
 		case BFI_INSTR_RTS:
+			chars += sprintf(line, "return p; ");
+			break;
+
 		case BFI_INSTR_RET:
 			line[0] = 0;
 			break;
@@ -389,9 +613,7 @@ static void translate(FILE *file) {
 			continue;
 		}
 
-		if(chars >= 80) chars = fprintf(file, "\n\t%s", line) + 6;
+	put:	if(chars >= 80) chars = fprintf(file, "\n\t%s", line) + 6;
 		else fputs(line, file);
 	}
-
-	fputc('\n', file);
-}
\ No newline at end of file
+}
@@ -26,6 +26,7 @@
 extern bool BFt_compile;
 extern bool BFt_translate;
 extern bool BFt_standalone;
+extern bool BFt_embed;
 
 extern void BFt_translate_c();
 